@@ -1,10 +1,18 @@
 #include "common/params.h"
 
 #include <dirent.h>
+#include <pthread.h>
 #include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <csignal>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 
 #include "common/swaglog.h"
@@ -83,6 +91,20 @@ private:
   int fd_ = -1;
 };
 
+// a counter in the shared sequence table is odd while a write is in progress
+class SeqWrite {
+public:
+  SeqWrite(std::atomic<uint32_t> *seq) : seq_(seq) {
+    if (seq_) seq_->fetch_add(1);
+  }
+  ~SeqWrite() {
+    if (seq_) seq_->fetch_add(1);
+  }
+
+private:
+  std::atomic<uint32_t> *seq_;
+};
+
 std::unordered_map<std::string, uint32_t> keys = {
     {"AccessToken", CLEAR_ON_MANAGER_START | DONT_LOG},
     {"ApiCache_Device", PERSISTENT},
@@ -100,6 +122,7 @@ std::unordered_map<std::string, uint32_t> keys = {
     {"CarParamsPersistent", PERSISTENT},
     {"CarVin", CLEAR_ON_MANAGER_START | CLEAR_ON_ONROAD_TRANSITION},
     {"CompletedTrainingVersion", PERSISTENT},
+    {"CompressLogs", PERSISTENT},
     {"ControlsReady", CLEAR_ON_MANAGER_START | CLEAR_ON_ONROAD_TRANSITION},
     {"CurrentBootlog", PERSISTENT},
     {"CurrentRoute", CLEAR_ON_MANAGER_START | CLEAR_ON_ONROAD_TRANSITION},
@@ -205,12 +228,325 @@ std::unordered_map<std::string, uint32_t> keys = {
     {"VisionRadarToggle", PERSISTENT},
 };
 
+const int PARAMS_SEQ_SLOTS = 1024;
+
+// mapped from <params>/<prefix>.seq by every process using the params. Params writers bump the counter
+// of a key around the rename, clearAll bumps the generation.
+struct ParamsSeqTable {
+  std::atomic<uint32_t> generation;
+  std::atomic<uint32_t> seq[PARAMS_SEQ_SLOTS];
+};
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+uint32_t seq_slot(const std::string &key) {
+  // fnv-1a, the same in every process
+  uint32_t h = 2166136261u;
+  for (unsigned char c : key) {
+    h = (h ^ c) * 16777619u;
+  }
+  return h % PARAMS_SEQ_SLOTS;
+}
+
 } // namespace
 
+// Process wide read cache of a params directory, shared by all the Params on it.
+// A cached value is used while the counters of its key in the shared sequence table are unchanged,
+// so a get doesn't make any syscalls. inotify catches writes that don't go through Params, and
+// wakes up the waiters and subscribers.
+// The watch is set up on the first waitForChange, subscribe or blocking get, values are read from the files until then.
+class ParamsCache : public std::enable_shared_from_this<ParamsCache> {
+public:
+  static std::shared_ptr<ParamsCache> open(const std::string &params_path, const std::string &prefix);
+  ParamsCache(const std::string &params_path, const std::string &prefix);
+  ~ParamsCache();
+
+  std::string get(const std::string &key);
+  std::atomic<uint32_t> *seq(const std::string &key) { return table ? &table->seq[seq_slot(key)] : nullptr; }
+  std::atomic<uint32_t> *generation() { return table ? &table->generation : nullptr; }
+  // a forked child opens the cache again
+  bool is_forked() const { return forked; }
+
+  uint64_t changes(const std::string &key);
+  bool wait(const std::string &key, uint64_t since, int timeout_ms);
+  int subscribe(const std::string &key, std::function<void(const std::string &)> callback);
+  void unsubscribe(int id);
+
+private:
+  struct Entry {
+    std::mutex lock;
+    bool valid = false;
+    uint32_t seq = 0;
+    uint32_t generation = 0;
+    uint64_t changes = 0;
+    std::string value;
+  };
+
+  void start();
+  void watch();
+  void changed(const std::string &key);
+  void invalidate_all();
+  static void after_fork();
+
+  std::string key_path;
+  ParamsSeqTable *table = nullptr;
+  int inotify_fd = -1;
+  std::once_flag start_once;
+  std::atomic<bool> alive{false};
+  std::atomic<bool> removed{false};
+  std::unordered_map<std::string, Entry> entries;
+
+  std::mutex notify_lock;
+  std::condition_variable cv;
+  std::unordered_map<std::string, uint64_t> key_changes;
+
+  std::mutex subscribers_lock;
+  std::map<int, std::pair<std::string, std::function<void(const std::string &)>>> subscribers;
+  int next_subscriber = 0;
+  // held by the watcher while it runs callbacks, unsubscribe waits on it
+  std::mutex callbacks_lock;
+  std::atomic<std::thread::id> watcher_id;
+  // the watcher and the locks stayed in the parent
+  std::atomic<bool> forked{false};
+
+  static inline std::mutex registry_lock;
+  static inline auto registry = new std::unordered_map<std::string, std::shared_ptr<ParamsCache>>();
+  // the caches of the parent in a forked child. never destroyed, their locks may be held by threads that didn't come along.
+  static inline auto forked_caches = new std::vector<std::shared_ptr<ParamsCache>>();
+};
+
+std::shared_ptr<ParamsCache> ParamsCache::open(const std::string &params_path, const std::string &prefix) {
+  static std::once_flag atfork_once;
+  std::call_once(atfork_once, [] {
+    pthread_atfork([] { registry_lock.lock(); }, [] { registry_lock.unlock(); }, after_fork);
+  });
+
+  std::lock_guard lk(registry_lock);
+  auto &cache = (*registry)[params_path + prefix];
+  // the directory got removed (or this is a forked child), start over
+  if (!cache || cache->removed) {
+    cache = std::make_shared<ParamsCache>(params_path, prefix);
+  }
+  return cache;
+}
+
+void ParamsCache::after_fork() {
+  // the watcher threads didn't come along
+  for (auto &[path, cache] : *registry) {
+    cache->alive = false;
+    cache->removed = true;
+    cache->forked = true;
+    forked_caches->push_back(cache);
+  }
+  registry_lock.unlock();
+}
+
+ParamsCache::ParamsCache(const std::string &params_path, const std::string &prefix) : key_path(params_path + prefix) {
+  std::string table_path = params_path + prefix + ".seq";
+  int fd = HANDLE_EINTR(::open(table_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0664));
+  if (fd >= 0) {
+    struct stat st = {};
+    if (fstat(fd, &st) == 0 && ((size_t)st.st_size >= sizeof(ParamsSeqTable) || ftruncate(fd, sizeof(ParamsSeqTable)) == 0)) {
+      void *p = mmap(nullptr, sizeof(ParamsSeqTable), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (p != MAP_FAILED) {
+        table = (ParamsSeqTable *)p;
+      }
+    }
+    close(fd);
+  }
+
+  for (auto &p : keys) {
+    entries.try_emplace(p.first);
+  }
+}
+
+void ParamsCache::start() {
+  std::call_once(start_once, [this] {
+    // the watch follows the prefix symlink to the directory of the values
+    inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd >= 0 && inotify_add_watch(inotify_fd, key_path.c_str(), IN_CREATE | IN_MODIFY | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_DELETE_SELF) < 0) {
+      close(inotify_fd);
+      inotify_fd = -1;
+    }
+    if (!table || inotify_fd < 0) {
+      // e.g. EMFILE: every process watching params takes an inotify instance, see fs.inotify.max_user_instances.
+      // reads go to the files, and waitForChange sleeps out its timeout.
+      static std::once_flag log_once;
+      std::call_once(log_once, [&, err = errno] {
+        LOGW("params cache disabled for %s, errno=%d", key_path.c_str(), err);
+      });
+      return;
+    }
+
+    alive = true;
+    std::thread(&ParamsCache::watch, shared_from_this()).detach();
+  });
+}
+
+ParamsCache::~ParamsCache() {
+  if (table) munmap(table, sizeof(ParamsSeqTable));
+  if (inotify_fd >= 0) close(inotify_fd);
+}
+
+std::string ParamsCache::get(const std::string &key) {
+  auto it = entries.find(key);
+  if (!alive || it == entries.end()) {
+    return util::read_file(key_path + "/" + key);
+  }
+
+  Entry &e = it->second;
+  std::atomic<uint32_t> &seq = table->seq[seq_slot(key)];
+  const uint32_t s = seq.load(std::memory_order_acquire);
+  const uint32_t g = table->generation.load(std::memory_order_acquire);
+  const bool writing = (s | g) & 1;
+  uint64_t changes;
+  {
+    std::lock_guard lk(e.lock);
+    if (e.valid && !writing && e.seq == s && e.generation == g) {
+      return e.value;
+    }
+    changes = e.changes;
+  }
+
+  std::string value = util::read_file(key_path + "/" + key);
+
+  // only keep it if nothing was written while reading
+  std::lock_guard lk(e.lock);
+  if (!writing && e.changes == changes && seq.load(std::memory_order_acquire) == s &&
+      table->generation.load(std::memory_order_acquire) == g) {
+    e.valid = true;
+    e.seq = s;
+    e.generation = g;
+    e.value = value;
+  }
+  return value;
+}
+
+uint64_t ParamsCache::changes(const std::string &key) {
+  start();
+  std::lock_guard lk(notify_lock);
+  auto it = key_changes.find(key);
+  return it != key_changes.end() ? it->second : 0;
+}
+
+bool ParamsCache::wait(const std::string &key, uint64_t since, int timeout_ms) {
+  start();
+  std::unique_lock lk(notify_lock);
+  auto changed = [&] {
+    auto it = key_changes.find(key);
+    return !alive || (it != key_changes.end() && it->second != since);
+  };
+  if (timeout_ms < 0) {
+    cv.wait(lk, changed);
+  } else {
+    cv.wait_for(lk, std::chrono::milliseconds(timeout_ms), changed);
+  }
+  if (!alive) {
+    lk.unlock();
+    if (timeout_ms > 0) util::sleep_for(timeout_ms);
+    return false;
+  }
+  auto it = key_changes.find(key);
+  return it != key_changes.end() && it->second != since;
+}
+
+int ParamsCache::subscribe(const std::string &key, std::function<void(const std::string &)> callback) {
+  start();
+  std::lock_guard lk(subscribers_lock);
+  subscribers[next_subscriber] = {key, callback};
+  return next_subscriber++;
+}
+
+void ParamsCache::unsubscribe(int id) {
+  {
+    std::lock_guard lk(subscribers_lock);
+    subscribers.erase(id);
+  }
+  // wait for a callback that's running right now, unless it's the one unsubscribing
+  if (std::this_thread::get_id() != watcher_id) {
+    std::lock_guard lk(callbacks_lock);
+  }
+}
+
+void ParamsCache::changed(const std::string &key) {
+  if (auto it = entries.find(key); it != entries.end()) {
+    std::lock_guard lk(it->second.lock);
+    it->second.valid = false;
+    it->second.changes++;
+  }
+  {
+    std::lock_guard lk(notify_lock);
+    key_changes[key]++;
+  }
+  cv.notify_all();
+
+  std::lock_guard running(callbacks_lock);
+  std::vector<std::function<void(const std::string &)>> callbacks;
+  {
+    std::lock_guard lk(subscribers_lock);
+    for (auto &[id, s] : subscribers) {
+      if (s.first == key) callbacks.push_back(s.second);
+    }
+  }
+  for (auto &callback : callbacks) {
+    callback(key);
+  }
+}
+
+void ParamsCache::invalidate_all() {
+  for (auto &[key, e] : entries) {
+    std::lock_guard lk(e.lock);
+    e.valid = false;
+    e.changes++;
+  }
+}
+
+void ParamsCache::watch() {
+  util::set_thread_name("params_watcher");
+  watcher_id = std::this_thread::get_id();
+  alignas(struct inotify_event) char buf[4096];
+  while (alive) {
+    ssize_t n = HANDLE_EINTR(read(inotify_fd, buf, sizeof(buf)));
+    if (n <= 0) break;
+
+    for (char *p = buf; p < buf + n; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+      auto ev = (struct inotify_event *)p;
+      if (ev->mask & (IN_DELETE_SELF | IN_IGNORED)) {
+        removed = true;
+        alive = false;
+      } else if (ev->mask & IN_Q_OVERFLOW) {
+        invalidate_all();
+        {
+          std::lock_guard lk(notify_lock);
+          for (auto &[key, c] : key_changes) c++;
+        }
+        cv.notify_all();
+      } else if (ev->len > 0) {
+        changed(ev->name);
+      }
+    }
+  }
+
+  alive = false;
+  invalidate_all();
+  {
+    // wake up the waiters, they fall back to sleeping
+    std::lock_guard lk(notify_lock);
+  }
+  cv.notify_all();
+}
+
 
 Params::Params(const std::string &path) {
   prefix = "/" + util::getenv("OPENPILOT_PREFIX", "d");
   params_path = ensure_params_path(prefix, path);
+  cache = ParamsCache::open(params_path, prefix);
+}
+
+ParamsCache &Params::cached() {
+  if (cache->is_forked()) {
+    cache = ParamsCache::open(params_path, prefix);
+  }
+  return *cache;
 }
 
 std::vector<std::string> Params::allKeys() const {
@@ -253,6 +589,7 @@ int Params::put(const char* key, const char* value, size_t value_size) {
     if ((result = fsync(tmp_fd)) < 0) break;
 
     FileLock file_lock(params_path + "/.lock");
+    SeqWrite seq_write(cached().seq(key));
 
     // Move temp into place.
     if ((result = rename(tmp_path.c_str(), getParamPath(key).c_str())) < 0) break;
@@ -266,8 +603,66 @@ int Params::put(const char* key, const char* value, size_t value_size) {
   return result;
 }
 
+int Params::Batch::commit() {
+  // 1) Write all the values to temp files, starting their writeback right away so it overlaps
+  // 2) fsync() the temp files
+  // 3) rename them to the real names under one lock
+  // 4) fsync() the containing directory once
+  std::vector<std::pair<std::string, int>> tmp_files;
+  int result = 0;
+  for (auto &[key, value] : values) {
+    std::string tmp_path = params.params_path + "/.tmp_value_XXXXXX";
+    int tmp_fd = mkstemp((char*)tmp_path.c_str());
+    if (tmp_fd < 0) {
+      result = -1;
+      break;
+    }
+    tmp_files.emplace_back(tmp_path, tmp_fd);
+
+    ssize_t bytes_written = HANDLE_EINTR(write(tmp_fd, value.data(), value.size()));
+    if (bytes_written < 0 || (size_t)bytes_written != value.size()) {
+      result = -20;
+      break;
+    }
+#ifdef __linux__
+    sync_file_range(tmp_fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+  }
+
+  for (size_t i = 0; i < tmp_files.size() && result >= 0; ++i) {
+    result = fsync(tmp_files[i].second);
+  }
+
+  // the first `renamed` temp files are in place, their names may already be reused by another writer's mkstemp
+  size_t renamed = 0;
+  if (result >= 0) {
+    FileLock file_lock(params.params_path + "/.lock");
+    for (; renamed < tmp_files.size(); ++renamed) {
+      const std::string &key = values[renamed].first;
+      SeqWrite seq_write(params.cached().seq(key));
+      if ((result = rename(tmp_files[renamed].first.c_str(), params.getParamPath(key).c_str())) < 0) break;
+    }
+
+    // the ones in place are made durable even if a later rename failed
+    if (renamed > 0) {
+      int dir_result = fsync_dir(params.getParamPath());
+      if (result >= 0) result = dir_result;
+    }
+  }
+
+  for (size_t i = 0; i < tmp_files.size(); ++i) {
+    close(tmp_files[i].second);
+    if (i >= renamed) {
+      ::unlink(tmp_files[i].first.c_str());
+    }
+  }
+  values.clear();
+  return result;
+}
+
 int Params::remove(const std::string &key) {
   FileLock file_lock(params_path + "/.lock");
+  SeqWrite seq_write(cached().seq(key));
   int result = unlink(getParamPath(key).c_str());
   if (result != 0) {
     return result;
@@ -277,7 +672,7 @@ int Params::remove(const std::string &key) {
 
 std::string Params::get(const std::string &key, bool block) {
   if (!block) {
-    return util::read_file(getParamPath(key));
+    return cached().get(key);
   } else {
     // blocking read until successful
     params_do_exit = 0;
@@ -286,10 +681,12 @@ std::string Params::get(const std::string &key, bool block) {
 
     std::string value;
     while (!params_do_exit) {
-      if (value = util::read_file(getParamPath(key)); !value.empty()) {
+      uint64_t changes = cached().changes(key);
+      if (value = cached().get(key); !value.empty()) {
         break;
       }
-      util::sleep_for(100);  // 0.1 s
+      // woken up by the write, the timeout is to check for the signals
+      cached().wait(key, changes, 100);
     }
 
     std::signal(SIGINT, prev_handler_sigint);
@@ -305,6 +702,7 @@ std::map<std::string, std::string> Params::readAll() {
 
 void Params::clearAll(ParamKeyType key_type) {
   FileLock file_lock(params_path + "/.lock");
+  SeqWrite seq_write(cached().generation());
 
   // 1) delete params of key_type
   // 2) delete files that are not defined in the keys.
@@ -323,3 +721,15 @@ void Params::clearAll(ParamKeyType key_type) {
 
   fsync_dir(getParamPath());
 }
+
+bool Params::waitForChange(const std::string &key, int timeout_ms) {
+  return cached().wait(key, cached().changes(key), timeout_ms);
+}
+
+int Params::subscribe(const std::string &key, std::function<void(const std::string &key)> callback) {
+  return cached().subscribe(key, callback);
+}
+
+void Params::unsubscribe(int id) {
+  cached().unsubscribe(id);
+}
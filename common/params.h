@@ -1,7 +1,10 @@
 #pragma once
 
+#include <functional>
 #include <map>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 enum ParamKeyType {
@@ -13,6 +16,8 @@ enum ParamKeyType {
   ALL = 0xFFFFFFFF
 };
 
+class ParamsCache;
+
 class Params {
 public:
   Params(const std::string &path = {});
@@ -34,6 +39,15 @@ public:
   }
   std::map<std::string, std::string> readAll();
 
+  // change notifications, for writes and removals from any process.
+  // waitForChange returns false on timeout. without a watch on the params directory
+  // it sleeps out the timeout, or returns right away when there is none.
+  bool waitForChange(const std::string &key, int timeout_ms = -1);
+  // the callback runs on the watcher thread. once unsubscribe returns, the callback isn't running and won't run again,
+  // so it must not wait for a thread that's unsubscribing. a callback may unsubscribe itself.
+  int subscribe(const std::string &key, std::function<void(const std::string &key)> callback);
+  void unsubscribe(int id);
+
   // helpers for writing values
   int put(const char *key, const char *val, size_t value_size);
   inline int put(const std::string &key, const std::string &val) {
@@ -43,7 +57,29 @@ public:
     return put(key.c_str(), val ? "1" : "0", 1);
   }
 
+  // Several writes made durable together: every key is still replaced atomically,
+  // but they share the lock and a single fsync of the directory. Nothing is written before commit().
+  class Batch {
+  public:
+    Batch(Params &params) : params(params) {}
+    inline void put(const std::string &key, const std::string &val) {
+      values.emplace_back(key, val);
+    }
+    inline void putBool(const std::string &key, bool val) {
+      values.emplace_back(key, val ? "1" : "0");
+    }
+    int commit();
+
+  private:
+    Params &params;
+    std::vector<std::pair<std::string, std::string>> values;
+  };
+
 private:
+  // the cache of this process. the one of the parent is replaced in a forked child, its locks may be held.
+  ParamsCache &cached();
+
   std::string params_path;
   std::string prefix;
+  std::shared_ptr<ParamsCache> cache;
 };
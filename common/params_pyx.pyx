@@ -21,10 +21,16 @@ cdef extern from "common/params.h":
     int put(string, string) nogil
     int putBool(string, bool) nogil
     bool checkKey(string) nogil
+    bool waitForChange(string, int) nogil
     string getParamPath(string) nogil
     void clearAll(ParamKeyType)
     vector[string] allKeys()
 
+  cdef cppclass c_ParamsBatch "Params::Batch":
+    c_ParamsBatch(c_Params&) nogil
+    void put(string, string) nogil
+    int commit() nogil
+
 
 def ensure_bytes(v):
   return v.encode() if isinstance(v, str) else v;
@@ -92,11 +98,35 @@ cdef class Params:
     with nogil:
       self.p.putBool(k, val)
 
+  def put_batch(self, items):
+    """
+    Writes several params with a single fsync of the params directory.
+    Each value is still replaced atomically. Blocks until all of them are on disk, like put.
+    """
+    cdef c_ParamsBatch* batch = new c_ParamsBatch(self.p[0])
+    cdef string k, dat_bytes
+    try:
+      for key, dat in (items.items() if isinstance(items, dict) else items):
+        k = self.check_key(key)
+        dat_bytes = (b"1" if dat else b"0") if isinstance(dat, bool) else ensure_bytes(dat)
+        batch.put(k, dat_bytes)
+      with nogil:
+        batch.commit()
+    finally:
+      del batch
+
   def remove(self, key):
     cdef string k = self.check_key(key)
     with nogil:
       self.p.remove(k)
 
+  def wait_for_change(self, key, int timeout_ms=-1):
+    cdef string k = self.check_key(key)
+    cdef bool r
+    with nogil:
+      r = self.p.waitForChange(k, timeout_ms)
+    return r
+
   def get_param_path(self, key=""):
     cdef string key_bytes = ensure_bytes(key)
     return self.p.getParamPath(key_bytes).decode("utf-8")
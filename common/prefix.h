@@ -24,6 +24,7 @@ public:
       std::string real_path = util::readlink(param_path);
       system(util::string_format("rm %s -rf", real_path.c_str()).c_str());
       unlink(param_path.c_str());
+      unlink((param_path + ".seq").c_str());
     }
     system(util::string_format("rm %s -rf", msgq_path.c_str()).c_str());
     unsetenv("OPENPILOT_PREFIX");
@@ -0,0 +1,57 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "common/params.h"
+#include "common/util.h"
+
+// keys/s of Params::put one at a time and of Params::Batch, on the filesystem of the given directory.
+// usage: ./benchmark_params [dir] [keys per batch] [rounds]
+
+int main(int argc, char *argv[]) {
+  std::string dir = argc > 1 ? argv[1] : "/tmp";
+  const int batch_size = argc > 2 ? atoi(argv[2]) : 8;
+  const int rounds = argc > 3 ? atoi(argv[3]) : 50;
+
+  std::string tmp_path = dir + "/params_benchmark_XXXXXX";
+  if (!mkdtemp((char *)tmp_path.c_str())) {
+    fprintf(stderr, "failed to create a directory in %s\n", dir.c_str());
+    return 1;
+  }
+
+  Params params(tmp_path);
+  std::vector<std::string> keys = params.allKeys();
+  keys.resize(std::min<size_t>(batch_size, keys.size()));
+  const std::string value(256, 'x');
+
+  auto keys_per_sec = [&](auto write_keys) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; ++i) {
+      write_keys();
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return rounds * keys.size() / secs;
+  };
+
+  double single = keys_per_sec([&]() {
+    for (auto &key : keys) {
+      params.put(key, value);
+    }
+  });
+  double batched = keys_per_sec([&]() {
+    Params::Batch batch(params);
+    for (auto &key : keys) {
+      batch.put(key, value);
+    }
+    batch.commit();
+  });
+
+  printf("%s, %zu keys of %zu bytes per round, %d rounds\n", dir.c_str(), keys.size(), value.size(), rounds);
+  printf("put:   %.0f keys/s\n", single);
+  printf("batch: %.0f keys/s\n", batched);
+
+  system(util::string_format("rm -rf %s", tmp_path.c_str()).c_str());
+  return 0;
+}
@@ -0,0 +1,85 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#define CATCH_CONFIG_MAIN
+#include "catch2/catch.hpp"
+#include "common/params.h"
+#include "common/util.h"
+
+TEST_CASE("Params::unsubscribe waits for a running callback") {
+  char tmp_path[] = "/tmp/test_params_XXXXXX";
+  REQUIRE(mkdtemp(tmp_path) != nullptr);
+  Params params(tmp_path);
+
+  std::atomic<int> started = 0, finished = 0;
+  int id = params.subscribe("CarParams", [&](const std::string &key) {
+    started++;
+    util::sleep_for(200);
+    finished++;
+  });
+  REQUIRE(params.put("CarParams", "1") == 0);
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (started == 0 && std::chrono::steady_clock::now() < deadline) {
+    util::sleep_for(1);
+  }
+  REQUIRE(started == 1);
+  params.unsubscribe(id);
+  REQUIRE(finished == 1);
+
+  // and it doesn't run again
+  REQUIRE(params.put("CarParams", "2") == 0);
+  util::sleep_for(200);
+  REQUIRE(started == 1);
+
+  system(util::string_format("rm -rf %s", tmp_path).c_str());
+}
+
+TEST_CASE("Params::waitForChange in a forked child") {
+  char tmp_path[] = "/tmp/test_params_XXXXXX";
+  REQUIRE(mkdtemp(tmp_path) != nullptr);
+  Params params(tmp_path);
+  // starts the watcher of the parent
+  REQUIRE_FALSE(params.waitForChange("CarParams", 0));
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    // the child watches the directory on its own
+    params.get("CarParams");
+    std::thread writer([&]() {
+      util::sleep_for(100);
+      params.put("CarParams", "1");
+    });
+    bool changed = params.waitForChange("CarParams", 5000);
+    writer.join();
+    _exit(changed && params.get("CarParams") == "1" ? 0 : 1);
+  }
+  int status = 0;
+  REQUIRE(waitpid(pid, &status, 0) == pid);
+  REQUIRE((WIFEXITED(status) && WEXITSTATUS(status) == 0));
+
+  system(util::string_format("rm -rf %s", tmp_path).c_str());
+}
+
+TEST_CASE("Params::Batch") {
+  char tmp_path[] = "/tmp/test_params_XXXXXX";
+  REQUIRE(mkdtemp(tmp_path) != nullptr);
+  Params params(tmp_path);
+
+  Params::Batch batch(params);
+  batch.put("CarParams", "1");
+  batch.putBool("IsMetric", true);
+  REQUIRE(batch.commit() == 0);
+  REQUIRE(params.get("CarParams") == "1");
+  REQUIRE(params.getBool("IsMetric"));
+
+  // the values are in place and no temp file is left behind
+  REQUIRE(util::check_output(util::string_format("find %s -name '.tmp_value_*'", tmp_path)).empty());
+
+  system(util::string_format("rm -rf %s", tmp_path).c_str());
+}
@@ -1,4 +1,5 @@
 import os
+import multiprocessing
 import threading
 import time
 import tempfile
@@ -8,6 +9,9 @@ import unittest
 
 from common.params import Params, ParamKeyType, UnknownKeyName, put_nonblocking, put_bool_nonblocking
 
+def _put(d, key, val):
+  Params(d).put(key, val)
+
 class TestParams(unittest.TestCase):
   def setUp(self):
     self.tmpdir = tempfile.mkdtemp()
@@ -55,6 +59,47 @@ class TestParams(unittest.TestCase):
     assert self.params.get("CarParams") is None
     assert self.params.get("CarParams", True) == b"test"
 
+  def test_params_put_from_other_process(self):
+    self.params.put("DongleId", "cached")
+    assert self.params.get("DongleId") == b"cached"
+    p = multiprocessing.Process(target=_put, args=(self.tmpdir, "DongleId", "other"))
+    p.start()
+    p.join()
+    assert self.params.get("DongleId") == b"other"
+
+  def test_params_external_write(self):
+    self.params.put("DongleId", "cached")
+    assert self.params.get("DongleId") == b"cached"
+    def _delayed_writer():
+      time.sleep(0.1)
+      with open(self.params.get_param_path("DongleId"), "w") as f:
+        f.write("external")
+    threading.Thread(target=_delayed_writer).start()
+    assert self.params.wait_for_change("DongleId", 1000)
+    time.sleep(0.1)
+    assert self.params.get("DongleId") == b"external"
+
+  def test_params_wait_for_change(self):
+    assert not self.params.wait_for_change("CarParams", 100)
+    def _delayed_writer():
+      time.sleep(0.1)
+      put_nonblocking("CarParams", "test", self.tmpdir)
+    threading.Thread(target=_delayed_writer).start()
+    assert self.params.wait_for_change("CarParams", 1000)
+    assert self.params.get("CarParams") == b"test"
+
+  def test_params_put_batch(self):
+    self.params.put("DongleId", "old")
+    self.params.put_batch({"DongleId": "new", "CarParams": b"\xe1\x90\xff", "IsMetric": True})
+    assert self.params.get("DongleId") == b"new"
+    assert self.params.get("CarParams") == b"\xe1\x90\xff"
+    assert self.params.get_bool("IsMetric")
+    assert not any(f.startswith(".tmp_value") for f in os.listdir(self.tmpdir))
+
+    with self.assertRaises(UnknownKeyName):
+      self.params.put_batch([("CarParams", "x"), ("swag", "abc")])
+    assert self.params.get("CarParams") == b"\xe1\x90\xff"
+
   def test_params_unknown_key_fails(self):
     with self.assertRaises(UnknownKeyName):
       self.params.get("swag")
@@ -239,37 +239,103 @@ void can_send_thread(std::vector<Panda *> pandas, bool fake_send) {
   }
 }
 
+// CAN receive. by default every panda is read at 100Hz and everything received is published right away.
+// with BOARDD_CAN_MAX_LATENCY_MS set, the pandas are polled every CAN_POLL_INTERVAL_NS instead, and the frames
+// are published once there are BOARDD_CAN_MIN_BATCH of them, or BOARDD_CAN_MAX_LATENCY_MS after the last publish.
+// consumers looping on "can" run once per publish, so the min batch should be around a cycle's worth of frames.
+#define CAN_POLL_INTERVAL_NS 1000000ULL
+#define CAN_LATENCY_LOG_INTERVAL_NS (60 * 1000000000ULL)
+
+// time from the read before a frame was received to its publish, the longest it could have waited.
+// the panda doesn't timestamp the frames (busTime is 0), so this is the best bound boardd has.
+struct CanLatencyHistogram {
+  static constexpr uint64_t BUCKET_US = 250;
+  static constexpr int BUCKETS = 100;  // the last one collects everything over 25ms
+  std::array<uint64_t, BUCKETS> counts = {};
+  uint64_t total = 0;
+  uint64_t max_us = 0;
+
+  void add(uint64_t us) {
+    counts[std::min<uint64_t>(us / BUCKET_US, BUCKETS - 1)]++;
+    max_us = std::max(max_us, us);
+    total++;
+  }
+
+  double percentile_ms(double p) const {
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+      seen += counts[i];
+      if (seen >= p * total) return (i + 1) * BUCKET_US / 1000.0;
+    }
+    return max_us / 1000.0;
+  }
+
+  void log_and_reset() {
+    if (total > 0) {
+      LOGW("can latency over %llu frames: p50 %.2fms, p90 %.2fms, p99 %.2fms, max %.2fms", total,
+           percentile_ms(0.5), percentile_ms(0.9), percentile_ms(0.99), max_us / 1000.0);
+    }
+    *this = {};
+  }
+};
+
 void can_recv_thread(std::vector<Panda *> pandas) {
   util::set_thread_name("boardd_can_recv");
 
   // can = 8006
   PubMaster pm({"can"});
 
-  // run at 100hz
-  const uint64_t dt = 10000000ULL;
+  const char *max_latency_env = getenv("BOARDD_CAN_MAX_LATENCY_MS");
+  const uint64_t max_latency = max_latency_env ? atof(max_latency_env) * 1e6 : 0;
+  // run at 100hz, or at the poll interval
+  uint64_t dt = 10000000ULL;
+  size_t min_batch = 0;
+  if (max_latency_env) {
+    dt = CAN_POLL_INTERVAL_NS;
+    min_batch = getenv("BOARDD_CAN_MIN_BATCH") ? atoi(getenv("BOARDD_CAN_MIN_BATCH")) : 1;
+    LOGW("can receive: polling every %.1fms, max latency %.1fms, min batch %zu", dt / 1e6, max_latency / 1e6, min_batch);
+  }
   uint64_t next_frame_time = nanos_since_boot() + dt;
+  // both are reused every cycle, receiving doesn't allocate once they've grown to the bus load
   std::vector<can_frame> raw_can_data;
+  CanEventBuilder can_builder;
+
+  // the read of its panda before each frame in raw_can_data, for the latency histogram
+  std::vector<uint64_t> frame_since;
+  std::vector<uint64_t> last_read(pandas.size(), nanos_since_boot());
+  CanLatencyHistogram latency;
+  uint64_t last_publish = nanos_since_boot();
+  uint64_t last_latency_log = last_publish;
+  bool comms_healthy = true;
 
   while (!do_exit && check_all_connected(pandas)) {
-    bool comms_healthy = true;
-    raw_can_data.clear();
-    for (const auto& panda : pandas) {
-      comms_healthy &= panda->can_receive(raw_can_data);
+    for (int i = 0; i < pandas.size(); ++i) {
+      const size_t received = raw_can_data.size();
+      comms_healthy &= pandas[i]->can_receive(raw_can_data);
+      frame_since.insert(frame_since.end(), raw_can_data.size() - received, last_read[i]);
+      last_read[i] = nanos_since_boot();
     }
 
-    MessageBuilder msg;
-    auto evt = msg.initEvent();
-    evt.setValid(comms_healthy);
-    auto canData = evt.initCan(raw_can_data.size());
-    for (uint i = 0; i<raw_can_data.size(); i++) {
-      canData[i].setAddress(raw_can_data[i].address);
-      canData[i].setBusTime(raw_can_data[i].busTime);
-      canData[i].setDat(kj::arrayPtr((uint8_t*)raw_can_data[i].dat.data(), raw_can_data[i].dat.size()));
-      canData[i].setSrc(raw_can_data[i].src);
+    uint64_t cur_time = nanos_since_boot();
+    if (raw_can_data.size() >= min_batch || cur_time - last_publish >= max_latency) {
+      auto bytes = can_builder.build(raw_can_data, comms_healthy);
+      pm.send("can", bytes.begin(), bytes.size());
+
+      cur_time = nanos_since_boot();
+      for (uint64_t since : frame_since) {
+        latency.add((cur_time - since) / 1000);
+      }
+      if (cur_time - last_latency_log >= CAN_LATENCY_LOG_INTERVAL_NS) {
+        latency.log_and_reset();
+        last_latency_log = cur_time;
+      }
+
+      raw_can_data.clear();
+      frame_since.clear();
+      comms_healthy = true;
+      last_publish = cur_time;
     }
-    pm.send("can", msg);
 
-    uint64_t cur_time = nanos_since_boot();
     int64_t remaining = next_frame_time - cur_time;
     if (remaining > 0) {
       std::this_thread::sleep_for(std::chrono::nanoseconds(remaining));
@@ -3,12 +3,14 @@
 from libcpp.vector cimport vector
 from libcpp.string cimport string
 from libcpp cimport bool
+from libc.string cimport memcpy
 
 cdef struct can_frame:
   long address
-  string dat
   long busTime
   long src
+  unsigned char len
+  unsigned char dat[64]
 
 cdef extern void can_list_to_can_capnp_cpp(const vector[can_frame] &can_list, string &out, bool sendCan, bool valid)
 
@@ -20,7 +22,10 @@ def can_list_to_can_capnp(can_msgs, msgtype='can', valid=True):
   for can_msg in can_msgs:
     f.address = can_msg[0]
     f.busTime = can_msg[1]
-    f.dat = can_msg[2]
+    dat = bytes(can_msg[2])
+    assert len(dat) <= 64
+    f.len = len(dat)
+    memcpy(f.dat, <const char *>dat, f.len)
     f.src = can_msg[3]
     can_list.push_back(f)
   cdef string out
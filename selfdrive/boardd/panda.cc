@@ -7,6 +7,7 @@
 
 #include "cereal/messaging/messaging.h"
 #include "common/swaglog.h"
+#include "common/timing.h"
 #include "common/util.h"
 
 Panda::Panda(std::string serial, uint32_t bus_offset) : bus_offset(bus_offset) {
@@ -177,59 +178,6 @@ void Panda::set_canfd_non_iso(uint16_t bus, bool non_iso) {
   handle->control_write(0xfc, bus, non_iso);
 }
 
-static uint8_t len_to_dlc(uint8_t len) {
-  if (len <= 8) {
-    return len;
-  }
-  if (len <= 24) {
-    return 8 + ((len - 8) / 4) + ((len % 4) ? 1 : 0);
-  } else {
-    return 11 + (len / 16) + ((len % 16) ? 1 : 0);
-  }
-}
-
-void Panda::pack_can_buffer(const capnp::List<cereal::CanData>::Reader &can_data_list,
-                            std::function<void(uint8_t *, size_t)> write_func) {
-  int32_t pos = 0;
-  uint8_t send_buf[2 * USB_TX_SOFT_LIMIT];
-
-  for (auto cmsg : can_data_list) {
-    // check if the message is intended for this panda
-    uint8_t bus = cmsg.getSrc();
-    if (bus < bus_offset || bus >= (bus_offset + PANDA_BUS_CNT)) {
-      continue;
-    }
-    auto can_data = cmsg.getDat();
-    uint8_t data_len_code = len_to_dlc(can_data.size());
-    assert(can_data.size() <= 64);
-    assert(can_data.size() == dlc_to_len[data_len_code]);
-
-    can_header header = {};
-    header.addr = cmsg.getAddress();
-    header.extended = (cmsg.getAddress() >= 0x800) ? 1 : 0;
-    header.data_len_code = data_len_code;
-    header.bus = bus - bus_offset;
-    header.checksum = 0;
-
-    memcpy(&send_buf[pos], (uint8_t *)&header, sizeof(can_header));
-    memcpy(&send_buf[pos + sizeof(can_header)], (uint8_t *)can_data.begin(), can_data.size());
-    uint32_t msg_size = sizeof(can_header) + can_data.size();
-
-    // set checksum
-    ((can_header *) &send_buf[pos])->checksum = calculate_checksum(&send_buf[pos], msg_size);
-
-    pos += msg_size;
-
-    if (pos >= USB_TX_SOFT_LIMIT) {
-      write_func(send_buf, pos);
-      pos = 0;
-    }
-  }
-
-  // send remaining packets
-  if (pos > 0) write_func(send_buf, pos);
-}
-
 void Panda::can_send(capnp::List<cereal::CanData>::Reader can_data_list) {
   pack_can_buffer(can_data_list, [=](uint8_t* data, size_t size) {
     handle->bulk_write(3, data, size, 5);
@@ -286,7 +234,8 @@ bool Panda::unpack_can_buffer(uint8_t *data, uint32_t &size, std::vector<can_fra
       return false;
     }
 
-    canData.dat.assign((char *)&data[pos + sizeof(can_header)], data_len);
+    canData.len = data_len;
+    memcpy(canData.dat, &data[pos + sizeof(can_header)], data_len);
 
     pos += sizeof(can_header) + data_len;
   }
@@ -298,10 +247,57 @@ bool Panda::unpack_can_buffer(uint8_t *data, uint32_t &size, std::vector<can_fra
   return true;
 }
 
-uint8_t Panda::calculate_checksum(uint8_t *data, uint32_t len) {
-  uint8_t checksum = 0U;
-  for (uint32_t i = 0U; i < len; i++) {
+uint8_t Panda::calculate_checksum(const uint8_t *data, uint32_t len) {
+  // xor a word at a time and fold it down to a byte, then the remaining bytes
+  uint64_t word_checksum = 0U;
+  uint32_t i = 0U;
+  for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+    uint64_t w;
+    memcpy(&w, &data[i], sizeof(w));
+    word_checksum ^= w;
+  }
+  word_checksum ^= word_checksum >> 32;
+  word_checksum ^= word_checksum >> 16;
+  word_checksum ^= word_checksum >> 8;
+
+  uint8_t checksum = word_checksum;
+  for (; i < len; i++) {
     checksum ^= data[i];
   }
   return checksum;
 }
+
+kj::ArrayPtr<capnp::byte> CanEventBuilder::build(const std::vector<can_frame> &frames, bool valid) {
+  // a CanData is two words plus its data, rounded up to words
+  const size_t words_needed = 1 + 64 + frames.size() * (2 + 64 / sizeof(capnp::word));
+  // the previous message is done with, destroying its builder hands back a zeroed arena
+  msg.reset();
+  if (arena_size < words_needed) {
+    arena_size = words_needed * 3 / 2;
+    arena = std::make_unique<capnp::word[]>(arena_size);
+  }
+
+  // the first word is left for the segment table
+  msg.emplace(kj::arrayPtr(arena.get() + 1, arena_size - 1));
+  auto evt = msg->initRoot<cereal::Event>();
+  evt.setLogMonoTime(nanos_since_boot());
+  evt.setValid(valid);
+  auto canData = evt.initCan(frames.size());
+  for (uint i = 0; i < frames.size(); i++) {
+    canData[i].setAddress(frames[i].address);
+    canData[i].setBusTime(frames[i].busTime);
+    canData[i].setDat(kj::arrayPtr(frames[i].dat, frames[i].len));
+    canData[i].setSrc(frames[i].src);
+  }
+
+  auto segments = msg->getSegmentsForOutput();
+  if (segments.size() == 1 && segments[0].begin() == arena.get() + 1) {
+    // the segment table of a single segment message: segment count - 1, segment size in words
+    uint32_t *table = reinterpret_cast<uint32_t *>(arena.get());
+    table[0] = 0;
+    table[1] = segments[0].size();
+    return kj::arrayPtr(reinterpret_cast<capnp::byte *>(arena.get()), (segments[0].size() + 1) * sizeof(capnp::word));
+  }
+  flat = capnp::messageToFlatArray(*msg);
+  return flat.asBytes();
+}
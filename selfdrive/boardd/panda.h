@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cassert>
 #include <cstdint>
+#include <cstring>
 #include <ctime>
 #include <functional>
 #include <list>
@@ -8,6 +10,8 @@
 #include <optional>
 #include <vector>
 
+#include <capnp/message.h>
+
 #include "cereal/gen/cpp/car.capnp.h"
 #include "cereal/gen/cpp/log.capnp.h"
 #include "panda/board/health.h"
@@ -33,11 +37,29 @@ struct __attribute__((packed)) can_header {
   uint8_t checksum : 8;
 };
 
+// fixed size so received frames can be kept in a reused vector without allocating.
+// keep in sync with boardd_api_impl.pyx
 struct can_frame {
   long address;
-  std::string dat;
   long busTime;
   long src;
+  uint8_t len;
+  uint8_t dat[64];
+};
+
+// builds "can" events in a buffer that's reused for every message
+class CanEventBuilder {
+public:
+  // the returned bytes are valid until the next call to build
+  kj::ArrayPtr<capnp::byte> build(const std::vector<can_frame> &frames, bool valid);
+
+private:
+  std::unique_ptr<capnp::word[]> arena;
+  size_t arena_size = 0;
+  kj::Array<capnp::word> flat;
+  // kept until the next build, its destructor zeroes the part of the arena it used.
+  // declared after arena so it's destroyed first.
+  std::optional<capnp::MallocMessageBuilder> msg;
 };
 
 
@@ -89,8 +111,60 @@ protected:
   uint32_t receive_buffer_size = 0;
 
   Panda(uint32_t bus_offset) : bus_offset(bus_offset) {}
-  void pack_can_buffer(const capnp::List<cereal::CanData>::Reader &can_data_list,
-                         std::function<void(uint8_t *, size_t)> write_func);
+  // write_func(uint8_t *data, size_t size) gets the packed buffer in chunks of about USB_TX_SOFT_LIMIT
+  template <class WriteFunc>
+  void pack_can_buffer(const capnp::List<cereal::CanData>::Reader &can_data_list, WriteFunc write_func);
   bool unpack_can_buffer(uint8_t *data, uint32_t &size, std::vector<can_frame> &out_vec);
-  uint8_t calculate_checksum(uint8_t *data, uint32_t len);
+  static uint8_t calculate_checksum(const uint8_t *data, uint32_t len);
 };
+
+inline uint8_t len_to_dlc(uint8_t len) {
+  if (len <= 8) {
+    return len;
+  }
+  if (len <= 24) {
+    return 8 + ((len - 8) / 4) + ((len % 4) ? 1 : 0);
+  } else {
+    return 11 + (len / 16) + ((len % 16) ? 1 : 0);
+  }
+}
+
+template <class WriteFunc>
+void Panda::pack_can_buffer(const capnp::List<cereal::CanData>::Reader &can_data_list, WriteFunc write_func) {
+  int32_t pos = 0;
+  uint8_t send_buf[2 * USB_TX_SOFT_LIMIT];
+
+  for (auto cmsg : can_data_list) {
+    // check if the message is intended for this panda
+    uint8_t bus = cmsg.getSrc();
+    if (bus < bus_offset || bus >= (bus_offset + PANDA_BUS_CNT)) {
+      continue;
+    }
+    auto can_data = cmsg.getDat();
+    uint8_t data_len_code = len_to_dlc(can_data.size());
+    assert(can_data.size() <= 64);
+    assert(can_data.size() == dlc_to_len[data_len_code]);
+
+    can_header header = {};
+    header.addr = cmsg.getAddress();
+    header.extended = (cmsg.getAddress() >= 0x800) ? 1 : 0;
+    header.data_len_code = data_len_code;
+    header.bus = bus - bus_offset;
+    header.checksum = 0;
+    // checksum from the source, so the packet is only written once
+    header.checksum = calculate_checksum((uint8_t *)&header, sizeof(can_header)) ^
+                      calculate_checksum(can_data.begin(), can_data.size());
+
+    memcpy(&send_buf[pos], (uint8_t *)&header, sizeof(can_header));
+    memcpy(&send_buf[pos + sizeof(can_header)], (uint8_t *)can_data.begin(), can_data.size());
+    pos += sizeof(can_header) + can_data.size();
+
+    if (pos >= USB_TX_SOFT_LIMIT) {
+      write_func(send_buf, pos);
+      pos = 0;
+    }
+  }
+
+  // send remaining packets
+  if (pos > 0) write_func(send_buf, pos);
+}
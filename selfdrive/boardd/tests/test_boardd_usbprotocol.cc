@@ -1,5 +1,7 @@
 #define CATCH_CONFIG_MAIN
 #define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <algorithm>
+#include <chrono>
 #include <random>
 
 #include "catch2/catch.hpp"
@@ -13,11 +15,24 @@ int random_int(int min, int max) {
   return dist(rng);
 }
 
+// the checksum as it was before, a byte at a time
+uint8_t bytewise_checksum(const uint8_t *data, uint32_t len) {
+  uint8_t checksum = 0U;
+  for (uint32_t i = 0U; i < len; i++) {
+    checksum ^= data[i];
+  }
+  return checksum;
+}
+
 struct PandaTest : public Panda {
   PandaTest(uint32_t bus_offset, int can_list_size, cereal::PandaState::PandaType hw_type);
   void test_can_send();
   void test_can_recv(uint32_t chunk_size = 0);
   void test_chunked_can_recv();
+  void test_can_recv_benchmark();
+  void test_checksum(int len);
+  void test_checksum_benchmark(int len);
+  void test_pack_benchmark();
 
   std::map<int, std::string> test_data;
   int can_list_size = 0;
@@ -103,10 +118,91 @@ void PandaTest::test_can_recv(uint32_t rx_chunk_size) {
   REQUIRE(frames.size() == can_list_size);
   for (int i = 0; i < frames.size(); ++i) {
     REQUIRE(frames[i].address == i);
-    REQUIRE(test_data.find(frames[i].dat.size()) != test_data.end());
-    const std::string &dat = test_data[frames[i].dat.size()];
-    REQUIRE(memcmp(dat.data(), frames[i].dat.data(), dat.size()) == 0);
+    REQUIRE(test_data.find(frames[i].len) != test_data.end());
+    const std::string &dat = test_data[frames[i].len];
+    REQUIRE(memcmp(dat.data(), frames[i].dat, dat.size()) == 0);
+  }
+
+  // and the "can" event built from them
+  CanEventBuilder builder;
+  auto bytes = builder.build(frames, true);
+  capnp::FlatArrayMessageReader reader(kj::arrayPtr((const capnp::word *)bytes.begin(), bytes.size() / sizeof(capnp::word)));
+  auto can = reader.getRoot<cereal::Event>().getCan();
+  REQUIRE(can.size() == frames.size());
+  for (int i = 0; i < can.size(); ++i) {
+    REQUIRE(can[i].getAddress() == frames[i].address);
+    REQUIRE(can[i].getSrc() == frames[i].src);
+    REQUIRE(can[i].getDat().size() == frames[i].len);
+    REQUIRE(memcmp(can[i].getDat().begin(), frames[i].dat, frames[i].len) == 0);
+  }
+}
+
+void PandaTest::test_can_recv_benchmark() {
+  std::vector<uint8_t> capture;
+  this->pack_can_buffer(can_data_list, [&](uint8_t *data, size_t size) {
+    capture.insert(capture.end(), data, data + size);
+  });
+  REQUIRE(capture.size() <= RECV_SIZE);
+
+  // same as can_recv_thread: reused frames and event buffer
+  std::vector<can_frame> frames;
+  CanEventBuilder builder;
+  const int iterations = 10000;
+  size_t total_bytes = 0;
+  bool ok = true;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    memcpy(this->receive_buffer, capture.data(), capture.size());
+    this->receive_buffer_size = capture.size();
+    frames.clear();
+    ok &= this->unpack_can_buffer(this->receive_buffer, this->receive_buffer_size, frames);
+    total_bytes += builder.build(frames, true).size();
   }
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  REQUIRE(ok);
+  REQUIRE(frames.size() == can_list_size);
+  printf("unpack + serialize: %d frames of %zu bytes, %.2f us/cycle, %.0f frames/s, %zu bytes/event\n",
+         can_list_size, capture.size(), secs / iterations * 1e6, iterations * can_list_size / secs, total_bytes / iterations);
+}
+
+void PandaTest::test_checksum(int len) {
+  std::mt19937 rng(len);
+  std::vector<uint8_t> data(len);
+  std::generate(data.begin(), data.end(), [&]() { return rng() & 0xff; });
+  REQUIRE(calculate_checksum(data.data(), len) == bytewise_checksum(data.data(), len));
+}
+
+void PandaTest::test_checksum_benchmark(int len) {
+  std::vector<uint8_t> data(len, 0xa5);
+  BENCHMARK("bytewise " + std::to_string(len) + " bytes") {
+    return bytewise_checksum(data.data(), len);
+  };
+  BENCHMARK("wordwise " + std::to_string(len) + " bytes") {
+    return calculate_checksum(data.data(), len);
+  };
+}
+
+void PandaTest::test_pack_benchmark() {
+  std::vector<uint8_t> packed;
+  this->pack_can_buffer(can_data_list, [&](uint8_t *data, size_t size) {
+    packed.insert(packed.end(), data, data + size);
+  });
+
+  BENCHMARK("pack " + std::to_string(can_list_size) + " frames") {
+    size_t total = 0;
+    this->pack_can_buffer(can_data_list, [&](uint8_t *data, size_t size) { total += size; });
+    return total;
+  };
+
+  std::vector<can_frame> frames;
+  std::vector<uint8_t> buf(packed.size());
+  BENCHMARK("unpack " + std::to_string(can_list_size) + " frames") {
+    frames.clear();
+    memcpy(buf.data(), packed.data(), buf.size());
+    uint32_t size = buf.size();
+    return this->unpack_can_buffer(buf.data(), size, frames);
+  };
+  REQUIRE(frames.size() == can_list_size);
 }
 
 TEST_CASE("send/recv CAN 2.0 packets") {
@@ -140,3 +236,29 @@ TEST_CASE("send/recv CAN FD packets") {
     test.test_can_recv(0x40);
   }
 }
+
+TEST_CASE("unpack and serialize a saturated CAN FD capture", "[!benchmark]") {
+  // about 10ms of three saturated CAN FD buses at 2Mbps data rate, frames of mixed lengths
+  // run with: selfdrive/boardd/tests/test_boardd_usbprotocol "[!benchmark]"
+  PandaTest test(0, 100, cereal::PandaState::PandaType::RED_PANDA);
+  test.test_can_recv_benchmark();
+}
+
+TEST_CASE("CAN checksum") {
+  auto len = GENERATE(1, 6, 14, 70, 255);
+  PandaTest test(0, 1, cereal::PandaState::PandaType::DOS);
+  test.test_checksum(len);
+}
+
+TEST_CASE("CAN checksum speed", "[!benchmark]") {
+  auto len = GENERATE(14, 70, 255);
+  PandaTest test(0, 1, cereal::PandaState::PandaType::DOS);
+  test.test_checksum_benchmark(len);
+}
+
+TEST_CASE("pack/unpack sendcan lists", "[!benchmark]") {
+  // 200 frames is a large sendcan list. frames of mixed lengths, up to 8 bytes on CAN 2.0 and 64 on CAN FD
+  auto hw_type = GENERATE(cereal::PandaState::PandaType::DOS, cereal::PandaState::PandaType::RED_PANDA);
+  PandaTest test(0, 200, hw_type);
+  test.test_pack_benchmark();
+}
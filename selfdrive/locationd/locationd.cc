@@ -45,6 +45,15 @@ static VectorXd floatlist2vector(const capnp::List<float, capnp::Kind::PRIMITIVE
   return res;
 }
 
+template <int N>
+static Matrix<double, N, 1> floatlist2vector(const capnp::List<float, capnp::Kind::PRIMITIVE>::Reader& floatlist) {
+  Matrix<double, N, 1> res;
+  for (int i = 0; i < N; i++) {
+    res[i] = floatlist[i];
+  }
+  return res;
+}
+
 static Vector4d quat2vector(const Quaterniond& quat) {
   return Vector4d(quat.w(), quat.x(), quat.y(), quat.z());
 }
@@ -65,9 +74,15 @@ static MatrixXdr rotate_cov(const MatrixXdr& rot_matrix, const MatrixXdr& cov_in
   return ((rot_matrix *  cov_in) * rot_matrix.transpose());
 }
 
-static VectorXd rotate_std(const MatrixXdr& rot_matrix, const VectorXd& std_in) {
+template <int N>
+static Matrix<double, N, N> rotate_cov(const Matrix<double, N, N>& rot_matrix, const Matrix<double, N, N>& cov_in) {
+  return rot_matrix * cov_in * rot_matrix.transpose();
+}
+
+template <int N>
+static Matrix<double, N, 1> rotate_std(const Matrix<double, N, N>& rot_matrix, const Matrix<double, N, 1>& std_in) {
   // Stds cannot be rotated like values, only covariances can be rotated
-  return rotate_cov(rot_matrix, std_in.array().square().matrix().asDiagonal()).diagonal().array().sqrt();
+  return rotate_cov<N>(rot_matrix, std_in.array().square().matrix().asDiagonal()).diagonal().array().sqrt();
 }
 
 Localizer::Localizer(LocalizerGnssSource gnss_source) {
@@ -75,8 +90,8 @@ Localizer::Localizer(LocalizerGnssSource gnss_source) {
   this->reset_kalman();
 
   this->calib = Vector3d(0.0, 0.0, 0.0);
-  this->device_from_calib = MatrixXdr::Identity(3, 3);
-  this->calib_from_device = MatrixXdr::Identity(3, 3);
+  this->device_from_calib = Matrix3d::Identity();
+  this->calib_from_device = Matrix3d::Identity();
 
   for (int i = 0; i < POSENET_STD_HIST_HALF * 2; i++) {
     this->posenet_stds.push_back(10.0);
@@ -85,6 +100,10 @@ Localizer::Localizer(LocalizerGnssSource gnss_source) {
   VectorXd ecef_pos = this->kf->get_x().segment<STATE_ECEF_POS_LEN>(STATE_ECEF_POS_START);
   this->converter = std::make_unique<LocalCoord>((ECEF) { .x = ecef_pos[0], .y = ecef_pos[1], .z = ecef_pos[2] });
   this->configure_gnss_source(gnss_source);
+
+  for (const char *service : CRITICAL_INPUT_SERVICES) {
+    this->observation_values_invalid.insert({service, 0.0});
+  }
 }
 
 void Localizer::build_live_location(cereal::LiveLocationKalman::Builder& fix) {
@@ -256,7 +275,7 @@ void Localizer::handle_sensor(double current_time, const cereal::SensorEventData
     auto v = log.getGyroUncalibrated().getV();
     auto meas = Vector3d(-v[2], -v[1], -v[0]);
     if (meas.norm() < ROTATION_SANITY_CHECK) {
-      this->kf->predict_and_observe(sensor_time, OBSERVATION_PHONE_GYRO, { meas });
+      this->kf->predict_and_observe<OBSERVATION_PHONE_GYRO>(sensor_time, meas);
       this->observation_values_invalid["gyroscope"] *= DECAY;
     }
     else{
@@ -275,7 +294,7 @@ void Localizer::handle_sensor(double current_time, const cereal::SensorEventData
 
     auto meas = Vector3d(-v[2], -v[1], -v[0]);
     if (meas.norm() < ACCEL_SANITY_CHECK) {
-      this->kf->predict_and_observe(sensor_time, OBSERVATION_PHONE_ACCEL, { meas });
+      this->kf->predict_and_observe<OBSERVATION_PHONE_ACCEL>(sensor_time, meas);
       this->observation_values_invalid["accelerometer"] *= DECAY;
     }
     else{
@@ -440,14 +459,14 @@ void Localizer::handle_car_state(double current_time, const cereal::CarState::Re
   this->car_speed = std::abs(log.getVEgo());
   this->standstill = log.getStandstill();
   if (this->standstill) {
-    this->kf->predict_and_observe(current_time, OBSERVATION_NO_ROT, { Vector3d(0.0, 0.0, 0.0) });
-    this->kf->predict_and_observe(current_time, OBSERVATION_NO_ACCEL, { Vector3d(0.0, 0.0, 0.0) });
+    this->kf->predict_and_observe<OBSERVATION_NO_ROT>(current_time, Vector3d::Zero());
+    this->kf->predict_and_observe<OBSERVATION_NO_ACCEL>(current_time, Vector3d::Zero());
   }
 }
 
 void Localizer::handle_cam_odo(double current_time, const cereal::CameraOdometry::Reader& log) {
-  VectorXd rot_device = this->device_from_calib * floatlist2vector(log.getRot());
-  VectorXd trans_device = this->device_from_calib * floatlist2vector(log.getTrans());
+  Vector3d rot_device = this->device_from_calib * floatlist2vector<3>(log.getRot());
+  Vector3d trans_device = this->device_from_calib * floatlist2vector<3>(log.getTrans());
 
   if (!this->is_timestamp_valid(current_time)) {
     this->observation_timings_invalid = true;
@@ -459,8 +478,8 @@ void Localizer::handle_cam_odo(double current_time, const cereal::CameraOdometry
     return;
   }
 
-  VectorXd rot_calib_std = floatlist2vector(log.getRotStd());
-  VectorXd trans_calib_std = floatlist2vector(log.getTransStd());
+  Vector3d rot_calib_std = floatlist2vector<3>(log.getRotStd());
+  Vector3d trans_calib_std = floatlist2vector<3>(log.getTransStd());
 
   if ((rot_calib_std.minCoeff() <= MIN_STD_SANITY_CHECK) || (trans_calib_std.minCoeff() <= MIN_STD_SANITY_CHECK)) {
     this->observation_values_invalid["cameraOdometry"] += 1.0;
@@ -478,12 +497,10 @@ void Localizer::handle_cam_odo(double current_time, const cereal::CameraOdometry
   // Multiply by 10 to avoid to high certainty in kalman filter because of temporally correlated noise
   trans_calib_std *= 10.0;
   rot_calib_std *= 10.0;
-  MatrixXdr rot_device_cov = rotate_std(this->device_from_calib, rot_calib_std).array().square().matrix().asDiagonal();
-  MatrixXdr trans_device_cov = rotate_std(this->device_from_calib, trans_calib_std).array().square().matrix().asDiagonal();
-  this->kf->predict_and_observe(current_time, OBSERVATION_CAMERA_ODO_ROTATION,
-    { rot_device }, { rot_device_cov });
-  this->kf->predict_and_observe(current_time, OBSERVATION_CAMERA_ODO_TRANSLATION,
-    { trans_device }, { trans_device_cov });
+  Matrix3d rot_device_cov = rotate_std(this->device_from_calib, rot_calib_std).array().square().matrix().asDiagonal();
+  Matrix3d trans_device_cov = rotate_std(this->device_from_calib, trans_calib_std).array().square().matrix().asDiagonal();
+  this->kf->predict_and_observe<OBSERVATION_CAMERA_ODO_ROTATION>(current_time, rot_device, rot_device_cov);
+  this->kf->predict_and_observe<OBSERVATION_CAMERA_ODO_TRANSLATION>(current_time, trans_device, trans_device_cov);
   this->observation_values_invalid["cameraOdometry"] *= DECAY;
 }
 
@@ -617,6 +634,12 @@ kj::ArrayPtr<capnp::byte> Localizer::get_message_bytes(MessageBuilder& msg_build
   return msg_builder.toBytes();
 }
 
+void Localizer::update_time_to_first_fix(double current_time) {
+  if (this->is_gps_ok() && std::isnan(this->ttff) && !std::isnan(this->first_valid_log_time)) {
+    this->ttff = std::max(1e-3, current_time - this->first_valid_log_time);
+  }
+}
+
 bool Localizer::is_gps_ok() {
   return (this->kf->get_filter_time() - this->last_gps_msg) < 2.0;
 }
@@ -691,10 +714,6 @@ int Localizer::locationd_thread() {
 
   uint64_t cnt = 0;
   bool filterInitialized = false;
-  const std::vector<std::string> critical_input_services = {"cameraOdometry", "liveCalibration", "accelerometer", "gyroscope"};
-  for (std::string service : critical_input_services) {
-    this->observation_values_invalid.insert({service, 0.0});
-  }
 
   while (!do_exit) {
     sm.update();
@@ -717,10 +736,7 @@ int Localizer::locationd_thread() {
       bool gpsOK = this->is_gps_ok();
       bool sensorsOK = sm.allAliveAndValid({"accelerometer", "gyroscope"});
 
-      // Log time to first fix
-      if (gpsOK && std::isnan(this->ttff) && !std::isnan(this->first_valid_log_time)) {
-        this->ttff = std::max(1e-3, (sm[trigger_msg].getLogMonoTime() * 1e-9) - this->first_valid_log_time);
-      }
+      this->update_time_to_first_fix(sm[trigger_msg].getLogMonoTime() * 1e-9);
 
       MessageBuilder msg_builder;
       kj::ArrayPtr<capnp::byte> bytes = this->get_message_bytes(msg_builder, inputsOK, sensorsOK, gpsOK, filterInitialized);
@@ -740,10 +756,3 @@ int Localizer::locationd_thread() {
   }
   return 0;
 }
-
-int main() {
-  util::set_realtime_priority(5);
-
-  Localizer localizer;
-  return localizer.locationd_thread();
-}
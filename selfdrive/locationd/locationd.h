@@ -21,6 +21,8 @@
 
 #define POSENET_STD_HIST_HALF 20
 
+const char *const CRITICAL_INPUT_SERVICES[] = {"cameraOdometry", "liveCalibration", "accelerometer", "gyroscope"};
+
 enum LocalizerGnssSource {
   UBLOX, QCOM
 };
@@ -38,6 +40,8 @@ public:
   void time_check(double current_time = NAN);
   void update_reset_tracker();
   bool is_gps_ok();
+  // log time to first fix
+  void update_time_to_first_fix(double current_time);
   bool critical_services_valid(std::map<std::string, double> critical_services);
   bool is_timestamp_valid(double current_time);
   void determine_gps_mode(double current_time);
@@ -66,9 +70,9 @@ public:
 private:
   std::unique_ptr<LiveKalman> kf;
 
-  Eigen::VectorXd calib;
-  MatrixXdr device_from_calib;
-  MatrixXdr calib_from_device;
+  Eigen::Vector3d calib;
+  Eigen::Matrix3d device_from_calib;
+  Eigen::Matrix3d calib_from_device;
   bool calibrated = false;
 
   double car_speed = 0.0;
@@ -0,0 +1,210 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <set>
+#include <thread>
+
+#include "cereal/services.h"
+#include "locationd.h"
+#include "tools/replay/logreader.h"
+
+// runs the Localizer over logs as fast as it goes, instead of at real time pace through locationd.
+// every job is a log, or a comma separated list of logs (e.g. a route's segments) run in order through one Localizer.
+// the liveLocationKalman outputs of job n are written to <output_dir>/<n>--<log's directory>.llk,
+// as the same stream of capnp events as an rlog.
+//
+// usage: locationd_batch [-j threads] -o output_dir log[,log...] ...
+
+extern ExitHandler do_exit;
+
+// what locationd's SubMaster knows about a service, from the log
+struct ServiceState {
+  double freq = 0;
+  bool ignore_alive = false;
+  bool valid = true;
+  uint64_t rcv_time = 0;
+  bool received = false;
+
+  bool alive(uint64_t t) const {
+    return freq <= 1e-5 || (received && (t - rcv_time) * 1e-9 < 10.0 / freq);
+  }
+};
+
+class LocalizerJob {
+public:
+  LocalizerJob(const std::vector<std::string> &logs, const std::string &output) : logs(logs), output(output) {}
+  bool run();
+
+private:
+  void handle(const cereal::Event::Reader &event);
+  bool allAliveAndValid(uint64_t t, const std::vector<std::string> &names = {});
+
+  std::vector<std::string> logs;
+  std::string output;
+  std::ofstream out;
+  std::unique_ptr<Localizer> localizer;
+  std::map<std::string, ServiceState> services_state;
+  bool filter_initialized = false;
+  bool not_car = false;
+};
+
+bool LocalizerJob::run() {
+  const std::set<cereal::Event::Which> allow = {
+    cereal::Event::Which::GPS_LOCATION, cereal::Event::Which::GPS_LOCATION_EXTERNAL,
+    cereal::Event::Which::CAMERA_ODOMETRY, cereal::Event::Which::LIVE_CALIBRATION, cereal::Event::Which::CAR_STATE,
+    cereal::Event::Which::CAR_PARAMS, cereal::Event::Which::ACCELEROMETER, cereal::Event::Which::GYROSCOPE,
+  };
+
+  out.open(output, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    fprintf(stderr, "failed to open %s\n", output.c_str());
+    return false;
+  }
+
+  for (const auto &log : logs) {
+    LogReader lr;
+    if (!lr.load(log, nullptr, allow)) {
+      fprintf(stderr, "failed to load %s\n", log.c_str());
+      return false;
+    }
+
+    if (!localizer) {
+      // locationd picks the source from the UbloxAvailable param, here it's whichever the log has
+      bool ublox = std::any_of(lr.events.begin(), lr.events.end(), [](const Event &e) {
+        return e.which == cereal::Event::Which::GPS_LOCATION_EXTERNAL;
+      });
+      localizer = std::make_unique<Localizer>(ublox ? LocalizerGnssSource::UBLOX : LocalizerGnssSource::QCOM);
+
+      const char *gps_location_socket = ublox ? "gpsLocationExternal" : "gpsLocation";
+      for (const char *name : {gps_location_socket, "cameraOdometry", "liveCalibration", "carState", "carParams", "accelerometer", "gyroscope"}) {
+        auto it = std::find_if(std::begin(services), std::end(services), [&](auto &s) { return strcmp(s.name, name) == 0; });
+        assert(it != std::end(services));
+        services_state[name] = {.freq = (double)it->frequency, .ignore_alive = strcmp(name, gps_location_socket) == 0 || strcmp(name, "carParams") == 0};
+      }
+    }
+
+    for (const Event &e : lr.events) {
+      if (do_exit) return false;
+      EventReader reader(e);
+      handle(reader.event);
+    }
+  }
+  return true;
+}
+
+// the same as an iteration of Localizer::locationd_thread, for one message
+void LocalizerJob::handle(const cereal::Event::Reader &event) {
+  static const std::map<cereal::Event::Which, std::string> service_names = {
+    {cereal::Event::Which::GPS_LOCATION_EXTERNAL, "gpsLocationExternal"},
+    {cereal::Event::Which::GPS_LOCATION, "gpsLocation"},
+    {cereal::Event::Which::CAMERA_ODOMETRY, "cameraOdometry"},
+    {cereal::Event::Which::LIVE_CALIBRATION, "liveCalibration"},
+    {cereal::Event::Which::CAR_STATE, "carState"},
+    {cereal::Event::Which::CAR_PARAMS, "carParams"},
+    {cereal::Event::Which::ACCELEROMETER, "accelerometer"},
+    {cereal::Event::Which::GYROSCOPE, "gyroscope"},
+  };
+  auto name_it = service_names.find(event.which());
+  if (name_it == service_names.end()) return;
+  const std::string &name = name_it->second;
+  auto it = services_state.find(name);
+  if (it == services_state.end()) return;  // the gps source that isn't used
+
+  const uint64_t t = event.getLogMonoTime();
+  it->second.valid = event.getValid();
+  it->second.rcv_time = t;
+  it->second.received = true;
+  if (event.isCarParams()) {
+    not_car = event.getCarParams().getNotCar();
+  }
+
+  if (filter_initialized) {
+    localizer->observation_timings_invalid_reset();
+    if (it->second.valid) {
+      localizer->handle_msg(event);
+    }
+  } else {
+    filter_initialized = allAliveAndValid(t);
+  }
+
+  // 100Hz publish for notcars, 20Hz for cars
+  if (name == (not_car ? "accelerometer" : "cameraOdometry")) {
+    bool inputsOK = allAliveAndValid(t) && localizer->are_inputs_ok();
+    bool gpsOK = localizer->is_gps_ok();
+    bool sensorsOK = allAliveAndValid(t, {"accelerometer", "gyroscope"});
+    localizer->update_time_to_first_fix(t * 1e-9);
+
+    MessageBuilder msg_builder;
+    localizer->get_message_bytes(msg_builder, inputsOK, sensorsOK, gpsOK, filter_initialized);
+    // stamped with the trigger's time instead of now
+    msg_builder.getRoot<cereal::Event>().setLogMonoTime(t);
+    auto words = capnp::messageToFlatArray(msg_builder);
+    auto bytes = words.asBytes();
+    out.write((const char *)bytes.begin(), bytes.size());
+  }
+}
+
+bool LocalizerJob::allAliveAndValid(uint64_t t, const std::vector<std::string> &names) {
+  for (const auto &[name, state] : services_state) {
+    if (!names.empty() && std::find(names.begin(), names.end(), name) == names.end()) continue;
+    if (!state.valid || !(state.alive(t) || state.ignore_alive)) return false;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  int threads = std::thread::hardware_concurrency();
+  std::string output_dir;
+  std::vector<std::vector<std::string>> jobs;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "-j" && i + 1 < argc) {
+      threads = std::max(1, atoi(argv[++i]));
+    } else if (arg == "-o" && i + 1 < argc) {
+      output_dir = argv[++i];
+    } else {
+      std::vector<std::string> logs;
+      for (size_t begin = 0, end; begin <= arg.size(); begin = end + 1) {
+        end = std::min(arg.find(',', begin), arg.size());
+        if (end > begin) logs.push_back(arg.substr(begin, end - begin));
+      }
+      if (logs.empty()) {
+        fprintf(stderr, "no logs in argument \"%s\"\n", arg.c_str());
+        return 1;
+      }
+      jobs.push_back(std::move(logs));
+    }
+  }
+  if (output_dir.empty() || jobs.empty()) {
+    fprintf(stderr, "usage: %s [-j threads] -o output_dir log[,log...] ...\n", argv[0]);
+    return 1;
+  }
+  util::create_directories(output_dir, 0775);
+
+  std::atomic<int> next_job = 0, failed = 0;
+  auto worker = [&]() {
+    for (int n = next_job++; n < jobs.size() && !do_exit; n = next_job++) {
+      const std::string &first = jobs[n][0];
+      std::string dir = first.substr(0, first.find_last_of('/'));
+      dir = dir.substr(dir.find_last_of('/') + 1);
+      std::string output = util::string_format("%s/%d--%s.llk", output_dir.c_str(), n, dir.c_str());
+
+      double start = millis_since_boot();
+      LocalizerJob job(jobs[n], output);
+      bool ok = job.run();
+      failed += !ok;
+      printf("%s %s in %.1fs\n", ok ? "done" : "failed", output.c_str(), (millis_since_boot() - start) / 1000.0);
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < std::min<int>(threads, jobs.size()); ++i) {
+    workers.emplace_back(worker);
+  }
+  for (auto &t : workers) t.join();
+  return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,8 @@
+#include "locationd.h"
+
+int main() {
+  util::set_realtime_priority(5);
+
+  Localizer localizer;
+  return localizer.locationd_thread();
+}
@@ -90,6 +90,10 @@ std::optional<Estimate> LiveKalman::predict_and_observe(double t, int kind, std:
   return r;
 }
 
+std::optional<Estimate> LiveKalman::predict_and_observe_one(double t, int kind, double *meas, double *R, int n) {
+  return this->filter->predict_and_update_batch(t, kind, { Map<VectorXd>(meas, n) }, { Map<MatrixXdr>(R, n, n) });
+}
+
 void LiveKalman::predict(double t) {
   this->filter->predict(t);
 }
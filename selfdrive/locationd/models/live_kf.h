@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <cassert>
 #include <cmath>
 #include <memory>
 
@@ -19,6 +20,12 @@ Eigen::Map<MatrixXdr> get_mapmat(MatrixXdr& mat);
 std::vector<Eigen::Map<Eigen::VectorXd>> get_vec_mapvec(std::vector<Eigen::VectorXd>& vec_vec);
 std::vector<Eigen::Map<MatrixXdr>> get_vec_mapmat(std::vector<MatrixXdr>& mat_vec);
 
+// fixed size measurement and noise types of an observation kind, sized by the generated constants
+template <int kind>
+using LiveObsVector = Eigen::Matrix<double, live_obs_dim(kind), 1>;
+template <int kind>
+using LiveObsCov = Eigen::Matrix<double, live_obs_dim(kind), live_obs_dim(kind), Eigen::RowMajor>;
+
 class LiveKalman {
 public:
   LiveKalman();
@@ -33,6 +40,22 @@ public:
   std::vector<MatrixXdr> get_R(int kind, int n);
 
   std::optional<Estimate> predict_and_observe(double t, int kind, std::vector<Eigen::VectorXd> meas, std::vector<MatrixXdr> R = {});
+
+  // a single observation without building dynamic vectors and matrices for it, for the high rate sensor paths.
+  // the first form uses the default noise of the kind.
+  template <int kind>
+  std::optional<Estimate> predict_and_observe(double t, const LiveObsVector<kind>& meas) {
+    LiveObsVector<kind> z = meas;
+    MatrixXdr &R = this->obs_noise.at(kind);
+    assert(R.rows() == z.rows() && R.cols() == z.rows());
+    return this->predict_and_observe_one(t, kind, z.data(), R.data(), z.rows());
+  }
+  template <int kind>
+  std::optional<Estimate> predict_and_observe(double t, const LiveObsVector<kind>& meas, const LiveObsCov<kind>& R) {
+    LiveObsVector<kind> z = meas;
+    LiveObsCov<kind> r = R;
+    return this->predict_and_observe_one(t, kind, z.data(), r.data(), z.rows());
+  }
   std::optional<Estimate> predict_and_update_odo_speed(std::vector<Eigen::VectorXd> speed, double t, int kind);
   std::optional<Estimate> predict_and_update_odo_trans(std::vector<Eigen::VectorXd> trans, double t, int kind);
   std::optional<Estimate> predict_and_update_odo_rot(std::vector<Eigen::VectorXd> rot, double t, int kind);
@@ -47,6 +70,8 @@ public:
   MatrixXdr H(Eigen::VectorXd in);
 
 private:
+  std::optional<Estimate> predict_and_observe_one(double t, int kind, double *meas, double *R, int n);
+
   std::string name = "live";
 
   std::shared_ptr<EKFSym> filter;
@@ -223,6 +223,20 @@ class LiveKalman():
       live_kf_header += f'#define OBSERVATION_{kind} {val}\n'
     live_kf_header += "\n"
 
+    # measurement sizes, so the cpp side can use fixed size types for the observations
+    obs_names = {val: kind for kind, val in inspect.getmembers(ObservationKind, lambda x: type(x) == int)}
+    obs_dims = {kind: h.shape[0] for h, kind, _ in obs_eqs}
+    for kind, dim in obs_dims.items():
+      live_kf_header += f'#define OBSERVATION_{obs_names[kind]}_LEN {dim}\n'
+    live_kf_header += "\n"
+    live_kf_header += "constexpr int live_obs_dim(int kind) {\n"
+    live_kf_header += "  switch (kind) {\n"
+    for kind, dim in obs_dims.items():
+      live_kf_header += f"    case {kind}: return {dim};\n"
+    live_kf_header += "    default: return -1;\n"
+    live_kf_header += "  }\n"
+    live_kf_header += "}\n\n"
+
     live_kf_header += f"static const Eigen::VectorXd live_initial_x = {numpy2eigenstring(LiveKalman.initial_x)};\n"
     live_kf_header += f"static const Eigen::VectorXd live_initial_P_diag = {numpy2eigenstring(LiveKalman.initial_P_diag)};\n"
     live_kf_header += f"static const Eigen::VectorXd live_fake_gps_pos_cov_diag = {numpy2eigenstring(LiveKalman.fake_gps_pos_cov_diag)};\n"
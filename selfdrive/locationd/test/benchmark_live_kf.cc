@@ -0,0 +1,76 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include "selfdrive/locationd/models/live_kf.h"
+
+// per update latency and heap allocations of the imu and camera odometry observations,
+// through the dynamic vector api and the fixed size one.
+// usage: ./benchmark_live_kf [updates]
+
+static size_t allocations = 0;
+
+void *operator new(size_t size) {
+  allocations++;
+  if (void *p = malloc(size)) return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+struct Result {
+  double us_per_update;
+  double allocs_per_update;
+};
+
+template <typename F>
+Result run(int updates, F update) {
+  LiveKalman kf;
+  // settle the filter first, the first updates grow its buffers
+  double t = 0.0;
+  for (int i = 0; i < 1000; i++) {
+    update(kf, t += 0.005, i);
+  }
+
+  size_t allocs = allocations;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < updates; i++) {
+    update(kf, t += 0.005, i);
+  }
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return {secs / updates * 1e6, (double)(allocations - allocs) / updates};
+}
+
+int main(int argc, char *argv[]) {
+  const int updates = argc > 1 ? atoi(argv[1]) : 100000;
+  const Eigen::Vector3d gyro(0.01, -0.02, 0.005);
+  const Eigen::Vector3d accel(9.81, 0.1, -0.2);
+  const Eigen::Vector3d odo_trans(0.5, 0.0, 0.01);
+  const Eigen::Matrix3d odo_cov = Eigen::Vector3d(1e-2, 1e-2, 1e-2).asDiagonal();
+
+  // gyro and accel alternate like the sensor events do, camera odometry every 5th update
+  Result dynamic = run(updates, [&](LiveKalman &kf, double t, int i) {
+    if (i % 5 == 4) {
+      MatrixXdr R = odo_cov;
+      kf.predict_and_observe(t, OBSERVATION_CAMERA_ODO_TRANSLATION, { odo_trans }, { R });
+    } else {
+      kf.predict_and_observe(t, (i % 2) ? OBSERVATION_PHONE_ACCEL : OBSERVATION_PHONE_GYRO, { (i % 2) ? accel : gyro });
+    }
+  });
+  Result fixed = run(updates, [&](LiveKalman &kf, double t, int i) {
+    if (i % 5 == 4) {
+      kf.predict_and_observe<OBSERVATION_CAMERA_ODO_TRANSLATION>(t, odo_trans, odo_cov);
+    } else if (i % 2) {
+      kf.predict_and_observe<OBSERVATION_PHONE_ACCEL>(t, accel);
+    } else {
+      kf.predict_and_observe<OBSERVATION_PHONE_GYRO>(t, gyro);
+    }
+  });
+
+  printf("%d updates\n", updates);
+  printf("dynamic: %.2f us/update, %.1f allocations/update\n", dynamic.us_per_update, dynamic.allocs_per_update);
+  printf("fixed:   %.2f us/update, %.1f allocations/update\n", fixed.us_per_update, fixed.allocs_per_update);
+  return 0;
+}
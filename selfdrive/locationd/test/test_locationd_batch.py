@@ -0,0 +1,41 @@
+#!/usr/bin/env python3
+import glob
+import os
+import subprocess
+import tempfile
+import unittest
+
+from common.basedir import BASEDIR
+from selfdrive.test.openpilotci import get_url
+from selfdrive.test.process_replay.compare_logs import compare_logs
+from selfdrive.test.process_replay.process_replay import get_process_config, replay_process
+from system.hardware import PC
+from tools.lib.logreader import LogReader
+
+LOCATIOND_BATCH = os.path.join(BASEDIR, "selfdrive/locationd/locationd_batch")
+# locationd's input segment in process_replay, TOYOTA in test_processes.py
+TEST_SEGMENT = "aregen8D6A8B36E8D|2023-05-10--14-32-38--0"
+
+
+@unittest.skipIf(not PC, "locationd_batch is only built on PC")
+class TestLocationdBatch(unittest.TestCase):
+  def test_matches_locationd(self):
+    url = get_url(*TEST_SEGMENT.rsplit("--", 1))
+    cfg = get_process_config("locationd")
+    lr = list(LogReader(url))
+    ref_msgs = [m for m in replay_process(cfg, lr, disable_progress=True) if m.which() == "liveLocationKalman"]
+
+    with tempfile.TemporaryDirectory() as output_dir:
+      subprocess.check_call([LOCATIOND_BATCH, "-j", "1", "-o", output_dir, url])
+      outputs = glob.glob(os.path.join(output_dir, "*.llk"))
+      self.assertEqual(len(outputs), 1)
+      with open(outputs[0], "rb") as f:
+        batch_msgs = list(LogReader.from_bytes(f.read()))
+
+    self.assertGreater(len(batch_msgs), 0)
+    diff = compare_logs(ref_msgs, batch_msgs, cfg.ignore, tolerance=cfg.tolerance)
+    self.assertEqual(len(diff), 0, diff[:10])
+
+
+if __name__ == "__main__":
+  unittest.main()
@@ -1,7 +1,10 @@
+#include <algorithm>
+#include <array>
 #include <cstdio>
 #include <cstdlib>
 #include <mutex>
 #include <cmath>
+#include <thread>
 
 #include <eigen3/Eigen/Dense>
 
@@ -11,6 +14,7 @@
 #include "cereal/visionipc/visionipc_client.h"
 #include "common/clutil.h"
 #include "common/params.h"
+#include "common/queue.h"
 #include "common/swaglog.h"
 #include "common/util.h"
 #include "system/hardware/hw.h"
@@ -57,6 +61,68 @@ mat3 update_calibration(Eigen::Vector3d device_from_calib_euler, bool wide_camer
 }
 
 
+// a frame on its way through the pipeline: warped by run_model, run by the inference thread and published
+struct ModelJob {
+  int slot = -1;  // -1 stops the threads
+  bool prepare_only = false;
+  float vec_desire[DESIRE_LEN] = {};
+  bool is_rhd = false;
+  float nav_features[NAV_FEATURE_LEN] = {};
+
+  VisionIpcBufExtra meta_main = {};
+  VisionIpcBufExtra meta_extra = {};
+  uint32_t frame_id = 0;
+  uint32_t vipc_dropped_frames = 0;
+  float frame_drop_ratio = 0;
+  bool nav_enabled = false;
+  bool live_calib_seen = false;
+
+  float model_execution_time = 0;
+  std::array<float, NET_OUTPUT_SIZE> output;
+};
+
+struct ModelLatencyStats {
+  uint32_t frames = 0, dropped = 0;
+  double sum_ms = 0, max_ms = 0;
+  double last_log = 0;
+
+  void add(const ModelJob &job) {
+    double latency_ms = (nanos_since_boot() - job.meta_main.timestamp_eof) / 1e6;
+    frames++;
+    dropped += job.vipc_dropped_frames;
+    sum_ms += latency_ms;
+    max_ms = std::max(max_ms, latency_ms);
+
+    double t = millis_since_boot();
+    if (t - last_log > 60 * 1000) {
+      LOGW("camera eof to modelV2 over %u frames: avg %.1fms, max %.1fms, %u frames dropped",
+           frames, sum_ms / frames, max_ms, dropped);
+      frames = dropped = 0;
+      sum_ms = max_ms = 0;
+      last_log = t;
+    }
+  }
+};
+
+bool run_job(ModelState &model, ModelJob &job, float *driving_style) {
+  double mt1 = millis_since_boot();
+  ModelOutput *model_output = model_eval_warped(&model, job.slot, true, job.vec_desire, job.is_rhd, driving_style, job.nav_features, job.prepare_only);
+  double mt2 = millis_since_boot();
+  job.model_execution_time = (mt2 - mt1) / 1000.0;
+  if (model_output == nullptr) {
+    return false;
+  }
+  job.output = model.output;
+  return true;
+}
+
+void publish_job(ModelState &model, PubMaster &pm, const ModelJob &job) {
+  const ModelOutput &model_output = *(const ModelOutput *)job.output.data();
+  model_publish(&model, pm, job.meta_main.frame_id, job.meta_extra.frame_id, job.frame_id, job.frame_drop_ratio, model_output, job.meta_main.timestamp_eof, job.model_execution_time,
+                job.nav_enabled, job.live_calib_seen);
+  posenet_publish(pm, job.meta_main.frame_id, job.vipc_dropped_frames, model_output, job.meta_main.timestamp_eof, job.live_calib_seen);
+}
+
 void run_model(ModelState &model, VisionIpcClient &vipc_client_main, VisionIpcClient &vipc_client_extra, bool main_wide_camera, bool use_extra_client) {
   // messaging
   PubMaster pm({"modelV2", "cameraOdometry"});
@@ -65,8 +131,7 @@ void run_model(ModelState &model, VisionIpcClient &vipc_client_main, VisionIpcCl
   // setup filter to track dropped frames
   FirstOrderFilter frame_dropped_filter(0., 10., 1. / MODEL_FREQ);
 
-  uint32_t frame_id = 0, last_vipc_frame_id = 0;
-  double last = 0;
+  uint32_t last_vipc_frame_id = 0;
   uint32_t run_count = 0;
 
   mat3 model_transform_main = {};
@@ -82,7 +147,48 @@ void run_model(ModelState &model, VisionIpcClient &vipc_client_main, VisionIpcCl
   VisionIpcBufExtra meta_main = {0};
   VisionIpcBufExtra meta_extra = {0};
 
+  // the next frame is received and warped here while the inference thread runs the model on the one before,
+  // and a third thread publishes. a warp slot is in use until the model ran on it, so this loop stays at most
+  // one frame ahead. MODELD_PIPELINE=0 runs everything in this loop, one frame after the other.
+  const bool pipeline = getenv("MODELD_PIPELINE") == nullptr || atoi(getenv("MODELD_PIPELINE")) != 0;
+  SafeQueue<int> free_slots;
+  for (int i = 0; i < ModelFrame::WARP_SLOTS; i++) {
+    free_slots.push(i);
+  }
+  SafeQueue<ModelJob> warped, finished;
+  ModelLatencyStats latency;
+
+  std::thread inference_thread, publish_thread;
+  if (pipeline) {
+    inference_thread = std::thread([&]() {
+      util::set_thread_name("modeld_inference");
+      while (true) {
+        ModelJob job = warped.pop();
+        if (job.slot < 0) break;
+        bool ran = run_job(model, job, driving_style);
+        free_slots.push(job.slot);
+        if (ran) finished.push(job);
+      }
+      finished.push(ModelJob{});
+    });
+    publish_thread = std::thread([&]() {
+      util::set_thread_name("modeld_publish");
+      while (true) {
+        ModelJob job = finished.pop();
+        if (job.slot < 0) break;
+        publish_job(model, pm, job);
+        latency.add(job);
+      }
+    });
+  }
+
+  ModelJob job;
   while (!do_exit) {
+    // wait for a free slot before receiving, so the frame is as recent as it can be
+    if (job.slot < 0) {
+      job.slot = free_slots.pop();
+    }
+
     // Keep receiving frames until we are at least 1 frame ahead of previous extra frame
     while (meta_main.timestamp_sof < meta_extra.timestamp_sof + 25000000ULL) {
       buf_main = vipc_client_main.recv(&meta_main);
@@ -119,8 +225,8 @@ void run_model(ModelState &model, VisionIpcClient &vipc_client_main, VisionIpcCl
     // TODO: path planner timeout?
     sm.update(0);
     int desire = ((int)sm["lateralPlan"].getLateralPlan().getDesire());
-    bool is_rhd = ((bool)sm["driverMonitoringState"].getDriverMonitoringState().getIsRHD());
-    frame_id = sm["roadCameraState"].getRoadCameraState().getFrameId();
+    job.is_rhd = ((bool)sm["driverMonitoringState"].getDriverMonitoringState().getIsRHD());
+    job.frame_id = sm["roadCameraState"].getRoadCameraState().getFrameId();
     if (sm.updated("liveCalibration")) {
       auto rpy_calib = sm["liveCalibration"].getLiveCalibration().getRpyCalib();
       Eigen::Vector3d device_from_calib_euler;
@@ -132,9 +238,9 @@ void run_model(ModelState &model, VisionIpcClient &vipc_client_main, VisionIpcCl
       live_calib_seen = true;
     }
 
-    float vec_desire[DESIRE_LEN] = {0};
+    std::fill_n(job.vec_desire, DESIRE_LEN, 0);
     if (desire >= 0 && desire < DESIRE_LEN) {
-      vec_desire[desire] = 1.0;
+      job.vec_desire[desire] = 1.0;
     }
 
     // Enable/disable nav features
@@ -155,6 +261,7 @@ void run_model(ModelState &model, VisionIpcClient &vipc_client_main, VisionIpcCl
         nav_features[i] = nav_model_features[i];
       }
     }
+    std::copy_n(nav_features, NAV_FEATURE_LEN, job.nav_features);
 
     // tracked dropped frames
     uint32_t vipc_dropped_frames = meta_main.frame_id - last_vipc_frame_id - 1;
@@ -165,28 +272,38 @@ void run_model(ModelState &model, VisionIpcClient &vipc_client_main, VisionIpcCl
     }
     run_count++;
 
-    float frame_drop_ratio = frames_dropped / (1 + frames_dropped);
-    bool prepare_only = vipc_dropped_frames > 0;
+    job.frame_drop_ratio = frames_dropped / (1 + frames_dropped);
+    job.vipc_dropped_frames = vipc_dropped_frames;
+    job.prepare_only = vipc_dropped_frames > 0;
+    job.meta_main = meta_main;
+    job.meta_extra = meta_extra;
+    job.nav_enabled = nav_enabled;
+    job.live_calib_seen = live_calib_seen;
 
-    if (prepare_only) {
+    if (job.prepare_only) {
       LOGE("skipping model eval. Dropped %d frames", vipc_dropped_frames);
     }
 
-    double mt1 = millis_since_boot();
-    ModelOutput *model_output = model_eval_frame(&model, buf_main, buf_extra, model_transform_main, model_transform_extra, vec_desire, is_rhd, driving_style, nav_features, prepare_only);
-    double mt2 = millis_since_boot();
-    float model_execution_time = (mt2 - mt1) / 1000.0;
-
-    if (model_output != nullptr) {
-      model_publish(&model, pm, meta_main.frame_id, meta_extra.frame_id, frame_id, frame_drop_ratio, *model_output, meta_main.timestamp_eof, model_execution_time,
-                    nav_enabled, live_calib_seen);
-      posenet_publish(pm, meta_main.frame_id, vipc_dropped_frames, *model_output, meta_main.timestamp_eof, live_calib_seen);
+    model_warp_frame(&model, buf_main, buf_extra, model_transform_main, model_transform_extra, job.slot);
+    if (pipeline) {
+      warped.push(job);
+    } else {
+      if (run_job(model, job, driving_style)) {
+        publish_job(model, pm, job);
+        latency.add(job);
+      }
+      free_slots.push(job.slot);
     }
+    job.slot = -1;
 
-    //printf("model process: %.2fms, from last %.2fms, vipc_frame_id %u, frame_id, %u, frame_drop %.3f\n", mt2 - mt1, mt1 - last, extra.frame_id, frame_id, frame_drop_ratio);
-    last = mt1;
     last_vipc_frame_id = meta_main.frame_id;
   }
+
+  if (pipeline) {
+    warped.push(ModelJob{});
+    inference_thread.join();
+    publish_thread.join();
+  }
 }
 
 int main(int argc, char **argv) {
@@ -13,9 +13,12 @@ ModelFrame::ModelFrame(cl_device_id device_id, cl_context context) {
   input_frames = std::make_unique<float[]>(buf_size);
 
   q = CL_CHECK_ERR(clCreateCommandQueue(context, device_id, 0, &err));
-  y_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, MODEL_WIDTH * MODEL_HEIGHT, NULL, &err));
-  u_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, (MODEL_WIDTH / 2) * (MODEL_HEIGHT / 2), NULL, &err));
-  v_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, (MODEL_WIDTH / 2) * (MODEL_HEIGHT / 2), NULL, &err));
+  load_q = CL_CHECK_ERR(clCreateCommandQueue(context, device_id, 0, &err));
+  for (int i = 0; i < WARP_SLOTS; i++) {
+    y_cl[i] = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, MODEL_WIDTH * MODEL_HEIGHT, NULL, &err));
+    u_cl[i] = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, (MODEL_WIDTH / 2) * (MODEL_HEIGHT / 2), NULL, &err));
+    v_cl[i] = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, (MODEL_WIDTH / 2) * (MODEL_HEIGHT / 2), NULL, &err));
+  }
   net_input_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, MODEL_FRAME_SIZE * sizeof(float), NULL, &err));
 
   transform_init(&transform, context, device_id);
@@ -23,21 +26,30 @@ ModelFrame::ModelFrame(cl_device_id device_id, cl_context context) {
 }
 
 float* ModelFrame::prepare(cl_mem yuv_cl, int frame_width, int frame_height, int frame_stride, int frame_uv_offset, const mat3 &projection, cl_mem *output) {
+  warp(yuv_cl, frame_width, frame_height, frame_stride, frame_uv_offset, projection, 0);
+  return load(0, output);
+}
+
+void ModelFrame::warp(cl_mem yuv_cl, int frame_width, int frame_height, int frame_stride, int frame_uv_offset, const mat3 &projection, int slot) {
   transform_queue(&this->transform, q,
                   yuv_cl, frame_width, frame_height, frame_stride, frame_uv_offset,
-                  y_cl, u_cl, v_cl, MODEL_WIDTH, MODEL_HEIGHT, projection);
+                  y_cl[slot], u_cl[slot], v_cl[slot], MODEL_WIDTH, MODEL_HEIGHT, projection);
+  // the camera buffer can be reused after this, and load runs on another queue
+  clFinish(q);
+}
 
+float* ModelFrame::load(int slot, cl_mem *output) {
   if (output == NULL) {
-    loadyuv_queue(&loadyuv, q, y_cl, u_cl, v_cl, net_input_cl);
+    loadyuv_queue(&loadyuv, load_q, y_cl[slot], u_cl[slot], v_cl[slot], net_input_cl);
 
     std::memmove(&input_frames[0], &input_frames[MODEL_FRAME_SIZE], sizeof(float) * MODEL_FRAME_SIZE);
-    CL_CHECK(clEnqueueReadBuffer(q, net_input_cl, CL_TRUE, 0, MODEL_FRAME_SIZE * sizeof(float), &input_frames[MODEL_FRAME_SIZE], 0, nullptr, nullptr));
-    clFinish(q);
+    CL_CHECK(clEnqueueReadBuffer(load_q, net_input_cl, CL_TRUE, 0, MODEL_FRAME_SIZE * sizeof(float), &input_frames[MODEL_FRAME_SIZE], 0, nullptr, nullptr));
+    clFinish(load_q);
     return &input_frames[0];
   } else {
-    loadyuv_queue(&loadyuv, q, y_cl, u_cl, v_cl, *output, true);
+    loadyuv_queue(&loadyuv, load_q, y_cl[slot], u_cl[slot], v_cl[slot], *output, true);
     // NOTE: Since thneed is using a different command queue, this clFinish is needed to ensure the image is ready.
-    clFinish(q);
+    clFinish(load_q);
     return NULL;
   }
 }
@@ -46,9 +58,12 @@ ModelFrame::~ModelFrame() {
   transform_destroy(&transform);
   loadyuv_destroy(&loadyuv);
   CL_CHECK(clReleaseMemObject(net_input_cl));
-  CL_CHECK(clReleaseMemObject(v_cl));
-  CL_CHECK(clReleaseMemObject(u_cl));
-  CL_CHECK(clReleaseMemObject(y_cl));
+  for (int i = 0; i < WARP_SLOTS; i++) {
+    CL_CHECK(clReleaseMemObject(v_cl[i]));
+    CL_CHECK(clReleaseMemObject(u_cl[i]));
+    CL_CHECK(clReleaseMemObject(y_cl[i]));
+  }
+  CL_CHECK(clReleaseCommandQueue(load_q));
   CL_CHECK(clReleaseCommandQueue(q));
 }
 
@@ -33,6 +33,13 @@ public:
   ~ModelFrame();
   float* prepare(cl_mem yuv_cl, int width, int height, int frame_stride, int frame_uv_offset, const mat3& transform, cl_mem *output);
 
+  // prepare in two steps, so the next frame can be warped while the model runs on this one.
+  // warp and load can be called from different threads, they have their own queues.
+  void warp(cl_mem yuv_cl, int width, int height, int frame_stride, int frame_uv_offset, const mat3& transform, int slot);
+  float* load(int slot, cl_mem *output);
+
+  static const int WARP_SLOTS = 2;
+
   const int MODEL_WIDTH = 512;
   const int MODEL_HEIGHT = 256;
   const int MODEL_FRAME_SIZE = MODEL_WIDTH * MODEL_HEIGHT * 3 / 2;
@@ -41,7 +48,8 @@ public:
 private:
   Transform transform;
   LoadYUVState loadyuv;
-  cl_command_queue q;
-  cl_mem y_cl, u_cl, v_cl, net_input_cl;
+  cl_command_queue q, load_q;
+  cl_mem y_cl[WARP_SLOTS], u_cl[WARP_SLOTS], v_cl[WARP_SLOTS];
+  cl_mem net_input_cl;
   std::unique_ptr<float[]> input_frames;
 };
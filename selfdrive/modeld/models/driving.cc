@@ -59,6 +59,20 @@ void model_init(ModelState* s, cl_device_id device_id, cl_context context) {
 
 ModelOutput* model_eval_frame(ModelState* s, VisionBuf* buf, VisionBuf* wbuf,
                               const mat3 &transform, const mat3 &transform_wide, float *desire_in, bool is_rhd, float *driving_style, float *nav_features, bool prepare_only) {
+  model_warp_frame(s, buf, wbuf, transform, transform_wide, 0);
+  return model_eval_warped(s, 0, wbuf != nullptr, desire_in, is_rhd, driving_style, nav_features, prepare_only);
+}
+
+void model_warp_frame(ModelState* s, VisionBuf* buf, VisionBuf* wbuf, const mat3 &transform, const mat3 &transform_wide, int slot) {
+  s->frame->warp(buf->buf_cl, buf->width, buf->height, buf->stride, buf->uv_offset, transform, slot);
+  if (wbuf != nullptr) {
+    s->wide_frame->warp(wbuf->buf_cl, wbuf->width, wbuf->height, wbuf->stride, wbuf->uv_offset, transform_wide, slot);
+  }
+  LOGT("Images warped");
+}
+
+ModelOutput* model_eval_warped(ModelState* s, int slot, bool has_wide,
+                               float *desire_in, bool is_rhd, float *driving_style, float *nav_features, bool prepare_only) {
 #ifdef DESIRE
   std::memmove(&s->pulse_desire[0], &s->pulse_desire[DESIRE_LEN], sizeof(float) * DESIRE_LEN*HISTORY_BUFFER_LEN);
   if (desire_in != NULL) {
@@ -89,12 +103,12 @@ LOGT("Desire enqueued");
   s->traffic_convention[1-rhd_idx] = 0.0;
 
   // if getInputBuf is not NULL, net_input_buf will be
-  auto net_input_buf = s->frame->prepare(buf->buf_cl, buf->width, buf->height, buf->stride, buf->uv_offset, transform, static_cast<cl_mem*>(s->m->getInputBuf()));
+  auto net_input_buf = s->frame->load(slot, static_cast<cl_mem*>(s->m->getInputBuf()));
   s->m->addImage(net_input_buf, s->frame->buf_size);
   LOGT("Image added");
 
-  if (wbuf != nullptr) {
-    auto net_extra_buf = s->wide_frame->prepare(wbuf->buf_cl, wbuf->width, wbuf->height, wbuf->stride, wbuf->uv_offset, transform_wide, static_cast<cl_mem*>(s->m->getExtraBuf()));
+  if (has_wide) {
+    auto net_extra_buf = s->wide_frame->load(slot, static_cast<cl_mem*>(s->m->getExtraBuf()));
     s->m->addExtra(net_extra_buf, s->wide_frame->buf_size);
     LOGT("Extra image added");
   }
@@ -417,7 +431,8 @@ void model_publish(ModelState* s, PubMaster &pm, uint32_t vipc_frame_id, uint32_
   framed.setModelExecutionTime(model_execution_time);
   framed.setNavEnabled(nav_enabled);
   if (send_raw_pred) {
-    framed.setRawPredictions((kj::ArrayPtr<const float>(s->output.data(), s->output.size())).asBytes());
+    // net_outputs is the start of a whole output buffer, not necessarily s->output
+    framed.setRawPredictions((kj::ArrayPtr<const float>((const float *)&net_outputs, s->output.size())).asBytes());
   }
   fill_model(s, framed, net_outputs);
   pm.send("modelV2", msg);
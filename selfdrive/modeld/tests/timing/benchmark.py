@@ -13,28 +13,37 @@ from selfdrive.manager.process_config import managed_processes
 N = int(os.getenv("N", "5"))
 TIME = int(os.getenv("TIME", "30"))
 
+# compare with MODELD_PIPELINE=0 for the serial loop
+
 if __name__ == "__main__":
   sock = messaging.sub_sock('modelV2', conflate=False, timeout=1000)
 
   execution_times = []
+  latencies = []
+  frame_drops = []
 
   for _ in range(N):
     os.environ['LOGPRINT'] = 'debug'
     managed_processes['modeld'].start()
     time.sleep(5)
 
-    t = []
+    t, lat, drop = [], [], []
     start = time.monotonic()
     while time.monotonic() - start < TIME:
       msgs = messaging.drain_sock(sock, wait_for_one=True)
       for m in msgs:
         t.append(m.modelV2.modelExecutionTime)
+        lat.append((m.logMonoTime - m.modelV2.timestampEof) / 1e6)
+        drop.append(m.modelV2.frameDropPerc)
 
     execution_times.append(np.array(t[10:]) * 1000)
+    latencies.append(np.array(lat[10:]))
+    frame_drops.append(np.array(drop[10:]))
     managed_processes['modeld'].stop()
 
   print("\n\n")
   print(f"ran modeld {N} times for {TIME}s each")
-  for n, t in enumerate(execution_times):
-    print(f"\tavg: {sum(t)/len(t):0.2f}ms, min: {min(t):0.2f}ms, max: {max(t):0.2f}ms")
+  for t, lat, drop in zip(execution_times, latencies, frame_drops):
+    print(f"\tavg: {sum(t)/len(t):0.2f}ms, min: {min(t):0.2f}ms, max: {max(t):0.2f}ms, "
+          f"camera eof to publish avg: {lat.mean():0.2f}ms, max: {lat.max():0.2f}ms, frame drop: {drop.mean():0.2f}%")
   print("\n\n")
@@ -21,6 +21,8 @@ class OpenpilotPrefix(object):
     if os.path.exists(symlink_path):
       shutil.rmtree(os.path.realpath(symlink_path), ignore_errors=True)
       os.remove(symlink_path)
+    if os.path.exists(symlink_path + ".seq"):
+      os.remove(symlink_path + ".seq")
     shutil.rmtree(self.msgq_path, ignore_errors=True)
     del os.environ['OPENPILOT_PREFIX']
     return False
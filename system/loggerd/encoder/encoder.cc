@@ -1,6 +1,8 @@
 #include <cassert>
 #include "system/loggerd/encoder/encoder.h"
 
+#include "common/timing.h"
+
 VideoEncoder::~VideoEncoder() {}
 
 void VideoEncoder::publisher_init() {
@@ -11,9 +13,19 @@ void VideoEncoder::publisher_init() {
 
 void VideoEncoder::publisher_publish(VideoEncoder *e, int segment_num, uint32_t idx, VisionIpcBufExtra &extra,
                                      unsigned int flags, kj::ArrayPtr<capnp::byte> header, kj::ArrayPtr<capnp::byte> dat) {
-  // broadcast packet
-  MessageBuilder msg;
-  auto event = msg.initEvent(true);
+  // the message is built in the encoder's arena, so the frame is copied once and sent without flattening it again.
+  // size the arena so the message fits in a single segment.
+  const size_t words_needed = 1 + (header.size() + dat.size()) / sizeof(capnp::word) + ENCODE_DATA_OVERHEAD_WORDS;
+  if (e->msg_arena_size < words_needed) {
+    e->msg_arena_size = words_needed * 3 / 2;
+    e->msg_arena = std::make_unique<capnp::word[]>(e->msg_arena_size);
+  }
+
+  // broadcast packet. the builder zeroes the part of the arena it used when it's destroyed, ready for the next frame.
+  capnp::MallocMessageBuilder msg(kj::arrayPtr(e->msg_arena.get() + 1, e->msg_arena_size - 1));
+  auto event = msg.initRoot<cereal::Event>();
+  event.setLogMonoTime(nanos_since_boot());
+  event.setValid(true);
   auto edat = (e->type == DriverCam) ? event.initDriverEncodeData() :
     ((e->type == WideRoadCam) ? event.initWideRoadEncodeData() :
     (e->in_width == e->out_width ? event.initRoadEncodeData() : event.initQRoadEncodeData()));
@@ -33,8 +45,16 @@ void VideoEncoder::publisher_publish(VideoEncoder *e, int segment_num, uint32_t
   edat.setData(dat);
   if (flags & V4L2_BUF_FLAG_KEYFRAME) edat.setHeader(header);
 
-  auto words = new kj::Array<capnp::word>(capnp::messageToFlatArray(msg));
-  auto bytes = words->asBytes();
-  e->pm->send(e->service_name, bytes.begin(), bytes.size());
-  delete words;
+  auto segments = msg.getSegmentsForOutput();
+  if (segments.size() == 1 && segments[0].begin() == e->msg_arena.get() + 1) {
+    // the segment table of a single segment message: segment count - 1, segment size in words
+    uint32_t *table = reinterpret_cast<uint32_t *>(e->msg_arena.get());
+    table[0] = 0;
+    table[1] = segments[0].size();
+    e->pm->send(e->service_name, reinterpret_cast<capnp::byte *>(e->msg_arena.get()), (segments[0].size() + 1) * sizeof(capnp::word));
+  } else {
+    auto words = capnp::messageToFlatArray(msg);
+    auto bytes = words.asBytes();
+    e->pm->send(e->service_name, bytes.begin(), bytes.size());
+  }
 }
@@ -11,6 +11,12 @@
 
 #define V4L2_BUF_FLAG_KEYFRAME 8
 
+// returned by encode_frame for a frame it drops on purpose, e.g. when encoding falls behind. it logs that itself.
+const int ENCODE_FRAME_DROPPED = -2;
+
+// room for the EncodeData fields besides the header and the frame data
+const size_t ENCODE_DATA_OVERHEAD_WORDS = 128;
+
 class VideoEncoder {
 public:
   VideoEncoder(const char* filename, CameraType type, int in_width, int in_height, int fps,
@@ -44,4 +50,7 @@ private:
   // publishing
   std::unique_ptr<PubMaster> pm;
   const char *service_name;
+  // reused for every message: a word for the segment table, then the message itself
+  std::unique_ptr<capnp::word[]> msg_arena;
+  size_t msg_arena_size = 0;
 };
@@ -8,6 +8,7 @@
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
+#include <mutex>
 
 #define __STDC_CONSTANT_MACROS
 
@@ -17,12 +18,134 @@ extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
 }
 
 #include "common/swaglog.h"
 #include "common/util.h"
 
 const int env_debug_encoder = (getenv("DEBUG_ENCODER") != NULL) ? atoi(getenv("DEBUG_ENCODER")) : 0;
+const bool env_encoder_lossy = getenv("ENCODER_LOSSY") != NULL;
+const char *env_encoder_preset = getenv("ENCODER_PRESET") ? getenv("ENCODER_PRESET") : "veryfast";
+const char *env_encoder_crf = getenv("ENCODER_CRF");
+const int env_encoder_threads = getenv("ENCODER_THREADS") ? atoi(getenv("ENCODER_THREADS")) : FFMPEG_CODEC_THREADS;
+
+static const char *lossy_codec_name(cereal::EncodeIndex::Type type) {
+  return type == cereal::EncodeIndex::Type::FULL_H_E_V_C ? "libx265" : "libx264";
+}
+
+cereal::EncodeIndex::Type ffmpeg_encode_type(cereal::EncodeIndex::Type type) {
+  if (!env_encoder_lossy) return cereal::EncodeIndex::Type::BIG_BOX_LOSSLESS;
+
+  if (!avcodec_find_encoder_by_name(lossy_codec_name(type))) {
+    LOGE("%s not available, encoding lossless", lossy_codec_name(type));
+    return cereal::EncodeIndex::Type::BIG_BOX_LOSSLESS;
+  }
+  return type;
+}
+
+AVCodecContext *ffmpeg_codec_open(cereal::EncodeIndex::Type type, int width, int height, int fps, int bitrate, int threads) {
+  const bool lossless = type == cereal::EncodeIndex::Type::BIG_BOX_LOSSLESS;
+  const AVCodec *codec = lossless ? avcodec_find_encoder(AV_CODEC_ID_FFVHUFF) : avcodec_find_encoder_by_name(lossy_codec_name(type));
+  if (!codec) return nullptr;
+
+  AVCodecContext *codec_ctx = avcodec_alloc_context3(codec);
+  assert(codec_ctx);
+  codec_ctx->width = width;
+  codec_ctx->height = height;
+  codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+  codec_ctx->time_base = (AVRational){ 1, fps };
+  codec_ctx->framerate = (AVRational){ fps, 1 };
+  codec_ctx->thread_count = threads;
+
+  if (lossless) {
+    codec_ctx->thread_type = FF_THREAD_FRAME;
+  } else {
+    // same GOP as the device encoder and no B frames, so packets come out in frame order.
+    // the codec headers are kept out of the packets and published as the EncodeData header.
+    codec_ctx->gop_size = type == cereal::EncodeIndex::Type::FULL_H_E_V_C ? 30 : 15;
+    codec_ctx->max_b_frames = 0;
+    codec_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    av_opt_set(codec_ctx->priv_data, "preset", env_encoder_preset, 0);
+    if (env_encoder_crf) {
+      av_opt_set(codec_ctx->priv_data, "crf", env_encoder_crf, 0);
+    } else {
+      codec_ctx->bit_rate = bitrate;
+      codec_ctx->rc_max_rate = bitrate;
+      codec_ctx->rc_buffer_size = bitrate;
+    }
+    if (type == cereal::EncodeIndex::Type::FULL_H_E_V_C) {
+      av_opt_set(codec_ctx->priv_data, "x265-params", "log-level=error", 0);
+    }
+  }
+
+  int err = avcodec_open2(codec_ctx, codec, NULL);
+  if (err < 0) {
+    LOGE("avcodec_open2 of %s failed: %d", codec->name, err);
+    avcodec_free_context(&codec_ctx);
+  }
+  return codec_ctx;
+}
+
+namespace {
+
+// the encoders of a camera get the same vipc buffer one after another, the first one converts it to I420
+// and the others share the converted frame. the buffers are pooled, a frame is ~3.5MB at full resolution.
+struct I420Frames {
+  std::mutex lock;
+  const VisionBuf *buf = nullptr;
+  uint32_t frame_id = 0;
+  std::shared_ptr<std::vector<uint8_t>> yuv;
+  std::vector<std::unique_ptr<std::vector<uint8_t>>> free_bufs;
+};
+
+I420Frames i420_frames[WideRoadCam + 1];
+
+std::shared_ptr<std::vector<uint8_t>> get_i420(CameraType type, const VisionBuf *buf, uint32_t frame_id) {
+  I420Frames &f = i420_frames[type];
+  std::shared_ptr<std::vector<uint8_t>> prev;
+  std::unique_lock lk(f.lock);
+  if (f.yuv && f.buf == buf && f.frame_id == frame_id) {
+    return f.yuv;
+  }
+
+  std::unique_ptr<std::vector<uint8_t>> v;
+  if (!f.free_bufs.empty()) {
+    v = std::move(f.free_bufs.back());
+    f.free_bufs.pop_back();
+  } else {
+    v = std::make_unique<std::vector<uint8_t>>();
+  }
+  v->resize(buf->width * buf->height * 3 / 2);
+
+  uint8_t *cy = v->data();
+  uint8_t *cu = cy + buf->width * buf->height;
+  uint8_t *cv = cu + (buf->width / 2) * (buf->height / 2);
+  libyuv::NV12ToI420(buf->y, buf->stride,
+                     buf->uv, buf->stride,
+                     cy, buf->width,
+                     cu, buf->width/2,
+                     cv, buf->width/2,
+                     buf->width, buf->height);
+
+  // hand the buffer back to the pool when the last encoder is done with it
+  auto yuv = std::shared_ptr<std::vector<uint8_t>>(v.release(), [&f](std::vector<uint8_t> *p) {
+    std::lock_guard lk(f.lock);
+    f.free_bufs.emplace_back(p);
+  });
+  // the previous frame may hold the last reference, release it after unlocking
+  prev = std::exchange(f.yuv, yuv);
+  f.buf = buf;
+  f.frame_id = frame_id;
+  lk.unlock();
+  return yuv;
+}
+
+void release_i420(void *opaque, uint8_t *data) {
+  delete (std::shared_ptr<std::vector<uint8_t>> *)opaque;
+}
+
+}  // namespace
 
 void FfmpegEncoder::encoder_init() {
   frame = av_frame_alloc();
@@ -34,57 +157,101 @@ void FfmpegEncoder::encoder_init() {
   frame->linesize[1] = out_width/2;
   frame->linesize[2] = out_width/2;
 
-  convert_buf.resize(in_width * in_height * 3 / 2);
-
   if (in_width != out_width || in_height != out_height) {
     downscale_buf.resize(out_width * out_height * 3 / 2);
   }
 
   publisher_init();
+  encode_handler_thread = std::thread(FfmpegEncoder::encode_handler, this);
 }
 
 FfmpegEncoder::~FfmpegEncoder() {
   encoder_close();
+  jobs.push({.type = EncodeJob::EXIT});
+  encode_handler_thread.join();
   av_frame_free(&frame);
 }
 
 void FfmpegEncoder::encoder_open(const char* path) {
-  const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_FFVHUFF);
+  queued = 0;
+  jobs.push({.type = EncodeJob::OPEN});
+}
 
-  this->codec_ctx = avcodec_alloc_context3(codec);
+void FfmpegEncoder::encoder_close() {
+  jobs.push({.type = EncodeJob::CLOSE});
+}
+
+int FfmpegEncoder::encode_frame(VisionBuf* buf, VisionIpcBufExtra *extra) {
+  assert(buf->width == this->in_width);
+  assert(buf->height == this->in_height);
+
+  if (jobs.size() >= FFMPEG_QUEUE_SIZE) {
+    if (!dropping) {
+      LOGE("encoder %s falling behind, dropping frame %d", filename, extra->frame_id);
+      dropping = true;
+    }
+    return ENCODE_FRAME_DROPPED;
+  }
+  dropping = false;
+
+  // the vipc buffer gets reused by camerad, so the frame is converted out of it before queueing
+  jobs.push({.type = EncodeJob::FRAME, .yuv = get_i420(type, buf, extra->frame_id), .extra = *extra});
+  return queued++;
+}
+
+void FfmpegEncoder::encode_handler(FfmpegEncoder *e) {
+  std::string encode_thread_name = "enc-"+std::string(e->filename);
+  util::set_thread_name(encode_thread_name.c_str());
+
+  while (true) {
+    EncodeJob job = e->jobs.pop();
+    if (job.type == EncodeJob::EXIT) {
+      break;
+    } else if (job.type == EncodeJob::OPEN) {
+      e->do_open();
+    } else if (job.type == EncodeJob::CLOSE) {
+      e->do_close();
+    } else if (e->is_open && e->do_encode(job) == -1) {
+      LOGE("Failed to encode frame. frame_id: %d", job.extra.frame_id);
+    }
+  }
+}
+
+void FfmpegEncoder::do_open() {
+  this->codec_ctx = ffmpeg_codec_open(codec, frame->width, frame->height, fps, bitrate, env_encoder_threads);
+  if (!this->codec_ctx && codec != cereal::EncodeIndex::Type::BIG_BOX_LOSSLESS) {
+    // e.g. a bad ENCODER_PRESET or ENCODER_CRF, or rate control settings the encoder rejects
+    LOGE("encoder %s failed to open %s, encoding lossless", filename, lossy_codec_name(codec));
+    codec = cereal::EncodeIndex::Type::BIG_BOX_LOSSLESS;
+    this->codec_ctx = ffmpeg_codec_open(codec, frame->width, frame->height, fps, bitrate, env_encoder_threads);
+  }
   assert(this->codec_ctx);
-  this->codec_ctx->width = frame->width;
-  this->codec_ctx->height = frame->height;
-  this->codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
-  this->codec_ctx->time_base = (AVRational){ 1, fps };
-  int err = avcodec_open2(this->codec_ctx, codec, NULL);
-  assert(err >= 0);
 
   is_open = true;
   segment_num++;
   counter = 0;
 }
 
-void FfmpegEncoder::encoder_close() {
+void FfmpegEncoder::do_close() {
   if (!is_open) return;
 
+  // frame threading holds back a few frames, get them out before the segment ends
+  if (avcodec_send_frame(this->codec_ctx, NULL) >= 0) {
+    receive_packets();
+  }
+  if (!in_flight.empty()) {
+    LOGE("encoder %s lost %zu frames on close", filename, in_flight.size());
+    in_flight.clear();
+  }
+
   avcodec_free_context(&codec_ctx);
   is_open = false;
 }
 
-int FfmpegEncoder::encode_frame(VisionBuf* buf, VisionIpcBufExtra *extra) {
-  assert(buf->width == this->in_width);
-  assert(buf->height == this->in_height);
-
-  uint8_t *cy = convert_buf.data();
+int FfmpegEncoder::do_encode(const EncodeJob &job) {
+  uint8_t *cy = job.yuv->data();
   uint8_t *cu = cy + in_width * in_height;
   uint8_t *cv = cu + (in_width / 2) * (in_height / 2);
-  libyuv::NV12ToI420(buf->y, buf->stride,
-                     buf->uv, buf->stride,
-                     cy, in_width,
-                     cu, in_width/2,
-                     cv, in_width/2,
-                     in_width, in_height);
 
   if (downscale_buf.size() > 0) {
     uint8_t *out_y = downscale_buf.data();
@@ -103,31 +270,38 @@ int FfmpegEncoder::encode_frame(VisionBuf* buf, VisionIpcBufExtra *extra) {
     frame->data[1] = out_u;
     frame->data[2] = out_v;
   } else {
+    // reference the shared frame instead of letting the codec copy it
+    frame->buf[0] = av_buffer_create(cy, job.yuv->size(), release_i420, new std::shared_ptr<std::vector<uint8_t>>(job.yuv), 0);
+    assert(frame->buf[0]);
     frame->data[0] = cy;
     frame->data[1] = cu;
     frame->data[2] = cv;
   }
-  frame->pts = counter*50*1000; // 50ms per frame
-
-  int ret = counter;
+  // in time_base units, the x26x rate control goes by the timestamps
+  frame->pts = counter;
 
   int err = avcodec_send_frame(this->codec_ctx, frame);
+  av_buffer_unref(&frame->buf[0]);
   if (err < 0) {
     LOGE("avcodec_send_frame error %d", err);
-    ret = -1;
+    return -1;
   }
+  in_flight[counter] = job.extra;
+  counter++;
+
+  return receive_packets();
+}
 
+int FfmpegEncoder::receive_packets() {
+  int ret = 0;
   AVPacket pkt;
   av_init_packet(&pkt);
   pkt.data = NULL;
   pkt.size = 0;
-  while (ret >= 0) {
-    err = avcodec_receive_packet(this->codec_ctx, &pkt);
-    if (err == AVERROR_EOF) {
-      break;
-    } else if (err == AVERROR(EAGAIN)) {
-      // Encoder might need a few frames on startup to get started. Keep going
-      ret = 0;
+  while (true) {
+    int err = avcodec_receive_packet(this->codec_ctx, &pkt);
+    if (err == AVERROR_EOF || err == AVERROR(EAGAIN)) {
+      // the frame threads are still busy or the codec is drained
       break;
     } else if (err < 0) {
       LOGE("avcodec_receive_packet error %d", err);
@@ -135,16 +309,27 @@ int FfmpegEncoder::encode_frame(VisionBuf* buf, VisionIpcBufExtra *extra) {
       break;
     }
 
+    // the codec passes the frame's pts on to its packet
+    auto it = in_flight.find(pkt.pts);
+    if (it == in_flight.end()) {
+      LOGE("encoder %s got a packet for no frame in flight, pts %lld", filename, (long long)pkt.pts);
+      av_packet_unref(&pkt);
+      continue;
+    }
+    const int idx = it->first;
+    VisionIpcBufExtra extra = it->second;
+    in_flight.erase(it);
+
     if (env_debug_encoder) {
-      printf("%20s got %8d bytes flags %8x idx %4d id %8d\n", this->filename, pkt.size, pkt.flags, counter, extra->frame_id);
+      printf("%20s got %8d bytes flags %8x idx %4d id %8d\n", this->filename, pkt.size, pkt.flags, idx, extra.frame_id);
     }
 
-    publisher_publish(this, segment_num, counter, *extra,
+    // TODO: get the header for lossless
+    auto header = codec == cereal::EncodeIndex::Type::BIG_BOX_LOSSLESS ? kj::arrayPtr<capnp::byte>(pkt.data, (size_t)0)
+                                                                       : kj::arrayPtr<capnp::byte>(codec_ctx->extradata, codec_ctx->extradata_size);
+    publisher_publish(this, segment_num, idx, extra,
       (pkt.flags & AV_PKT_FLAG_KEY) ? V4L2_BUF_FLAG_KEYFRAME : 0,
-      kj::arrayPtr<capnp::byte>(pkt.data, (size_t)0), // TODO: get the header
-      kj::arrayPtr<capnp::byte>(pkt.data, pkt.size));
-
-    counter++;
+      header, kj::arrayPtr<capnp::byte>(pkt.data, pkt.size));
   }
   av_packet_unref(&pkt);
   return ret;
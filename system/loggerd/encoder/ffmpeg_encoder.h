@@ -2,7 +2,10 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <map>
+#include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
 extern "C" {
@@ -11,16 +14,29 @@ extern "C" {
 #include <libavutil/imgutils.h>
 }
 
+#include "common/queue.h"
 #include "system/loggerd/encoder/encoder.h"
 #include "system/loggerd/loggerd.h"
 
+// frames waiting for an encoder before new ones are dropped
+#define FFMPEG_QUEUE_SIZE 5
+// codec threads of each encoder, ENCODER_THREADS overrides it
+#define FFMPEG_CODEC_THREADS 2
+
+// encoding is lossless (ffvhuff) unless ENCODER_LOSSY is set, then the streams are encoded like on device
+// with libx265/libx264. ENCODER_PRESET picks the x26x preset and ENCODER_CRF replaces the bitrate with a CRF.
+// tests/encoder_benchmark measures the encode fps for a number of threads.
+cereal::EncodeIndex::Type ffmpeg_encode_type(cereal::EncodeIndex::Type type);
+// opens the codec for a stream of the given encode type, nullptr if it's not available
+AVCodecContext *ffmpeg_codec_open(cereal::EncodeIndex::Type type, int width, int height, int fps, int bitrate, int threads);
+
 class FfmpegEncoder : public VideoEncoder {
  public:
   FfmpegEncoder(const char* filename, CameraType type, int in_width, int in_height, int fps,
 
                 int bitrate, cereal::EncodeIndex::Type codec, int out_width, int out_height,
                 const char* publish_name) :
-                VideoEncoder(filename, type, in_width, in_height, fps, bitrate, cereal::EncodeIndex::Type::BIG_BOX_LOSSLESS, out_width, out_height, publish_name) { encoder_init(); }
+                VideoEncoder(filename, type, in_width, in_height, fps, bitrate, ffmpeg_encode_type(codec), out_width, out_height, publish_name) { encoder_init(); }
   ~FfmpegEncoder();
   void encoder_init();
   int encode_frame(VisionBuf* buf, VisionIpcBufExtra *extra);
@@ -28,12 +44,33 @@ class FfmpegEncoder : public VideoEncoder {
   void encoder_close();
 
 private:
+  struct EncodeJob {
+    enum { OPEN, CLOSE, FRAME, EXIT } type;
+    std::shared_ptr<std::vector<uint8_t>> yuv;  // I420, in_width x in_height
+    VisionIpcBufExtra extra;
+  };
+
+  void do_open();
+  void do_close();
+  int do_encode(const EncodeJob &job);
+  int receive_packets();
+
   int segment_num = -1;
   int counter = 0;
   bool is_open = false;
 
+  // frames queued since the last open, counted on the caller's thread
+  int queued = 0;
+  bool dropping = false;
+
+  // encoding runs on its own thread, the caller only converts the frame out of the vipc buffer
+  static void encode_handler(FfmpegEncoder *e);
+  std::thread encode_handler_thread;
+  SafeQueue<EncodeJob> jobs;
+
   AVCodecContext *codec_ctx;
   AVFrame *frame = NULL;
-  std::vector<uint8_t> convert_buf;
   std::vector<uint8_t> downscale_buf;
+  // frames sent to the codec and not received yet, by their pts
+  std::map<int64_t, VisionIpcBufExtra> in_flight;
 };
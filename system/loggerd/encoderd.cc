@@ -106,6 +106,7 @@ void encoder_thread(EncoderdState *s, const LogCameraInfo &cam_info) {
       for (int i = 0; i < encoders.size(); ++i) {
         int out_id = encoders[i]->encode_frame(buf, &extra);
 
+        // dropped frames are logged by the encoder
         if (out_id == -1) {
           LOGE("Failed to encode frame. frame_id: %d", extra.frame_id);
         }
@@ -17,8 +17,270 @@
 
 #include "common/params.h"
 #include "common/swaglog.h"
+#include "common/timing.h"
 #include "common/version.h"
 
+// ***** RawFile *****
+
+static double thread_cpu_ms() {
+  struct timespec t;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+  return t.tv_sec * 1000.0 + t.tv_nsec * 1e-6;
+}
+
+RawFile::RawFile(const char* path, bool compress, const char* index_path)
+    : path(path), index_path(index_path ? index_path : "") {
+  file = util::safe_fopen(path, "wb");
+  assert(file != nullptr);
+  // the writer thread only writes whole blocks, stdio buffering would just copy them again
+  setvbuf(file, nullptr, _IONBF, 0);
+  block = allocBlock(RAW_FILE_BLOCK_SIZE);
+  if (compress) {
+    bz = std::make_unique<bz_stream>();
+    int ret = BZ2_bzCompressInit(bz.get(), 9, 0, 30);
+    assert(ret == BZ_OK);
+    bz_out = std::make_unique<char[]>(RAW_FILE_BLOCK_SIZE);
+    last_flush_tms = millis_since_boot();
+  }
+  writer = std::thread(&RawFile::writerThread, this);
+}
+
+RawFile::~RawFile() {
+  queueBlock();
+  {
+    std::lock_guard lk(lock);
+    exit = true;
+  }
+  cv.notify_all();
+  writer.join();
+  if (!index_path.empty()) {
+    writeIndex();
+  }
+
+  if (bz) {
+    BZ2_bzCompressEnd(bz.get());
+    const double mb_in = bytes_in / 1e6, mb_out = bytes_out / 1e6;
+    LOGD("%s: compressed %.2f MB to %.2f MB, saved %.2f MB, %.1f ms CPU per MB",
+         path.c_str(), mb_in, mb_out, mb_in - mb_out, mb_in > 0 ? compress_cpu_ms / mb_in : 0.);
+  }
+
+  util::safe_fflush(file);
+  int err = fclose(file);
+  assert(err == 0);
+}
+
+RawFile::Block RawFile::allocBlock(size_t capacity) {
+  // page aligned, as the kernel likes it
+  capacity = (capacity + 4095) & ~size_t(4095);
+  Block b;
+  b.data.reset((uint8_t*)aligned_alloc(4096, capacity));
+  assert(b.data);
+  b.capacity = capacity;
+  return b;
+}
+
+void RawFile::write(void* data, size_t size) {
+  if (block.size + size > block.capacity) {
+    queueBlock();
+    if (size > block.capacity) {
+      // larger than a block, give it a block of its own
+      Block large = allocBlock(size);
+      memcpy(large.data.get(), data, size);
+      large.size = size;
+      queueBlock(std::move(large));
+      return;
+    }
+  }
+
+  if (block.size == 0) {
+    block_start_tms = millis_since_boot();
+  }
+  memcpy(block.data.get() + block.size, data, size);
+  block.size += size;
+
+  if (block.size == block.capacity || millis_since_boot() - block_start_tms > RAW_FILE_FLUSH_INTERVAL_MS) {
+    queueBlock();
+  }
+}
+
+// hands the current block to the writer thread and continues with a free one
+void RawFile::queueBlock() {
+  if (block.size == 0) return;
+
+  queueBlock(std::move(block));
+  {
+    std::lock_guard lk(lock);
+    if (!free_blocks.empty()) {
+      block = std::move(free_blocks.back());
+      free_blocks.pop_back();
+    }
+  }
+  if (!block.data) {
+    block = allocBlock(RAW_FILE_BLOCK_SIZE);
+  }
+  block.size = 0;
+}
+
+void RawFile::queueBlock(Block &&b) {
+  std::unique_lock lk(lock);
+  // storage can't keep up. stall the producer rather than queue without bound.
+  cv.wait(lk, [this]() { return queue.size() < RAW_FILE_MAX_QUEUED_BLOCKS; });
+  queued_bytes += b.size;
+  queue.push_back(std::move(b));
+  lk.unlock();
+  cv.notify_all();
+}
+
+void RawFile::writerThread() {
+  std::unique_lock lk(lock);
+  while (true) {
+    cv.wait(lk, [this]() { return exit || !queue.empty(); });
+    if (queue.empty()) break;
+
+    Block b = std::move(queue.front());
+    queue.pop_front();
+    lk.unlock();
+
+    const bool flush = bz && millis_since_boot() - last_flush_tms > RAW_FILE_COMPRESS_FLUSH_INTERVAL_MS;
+    writeBlock(b, flush ? BZ_FLUSH : BZ_RUN);
+    if (!index_path.empty()) {
+      indexBlock(b);
+    }
+
+    lk.lock();
+    queued_bytes -= b.size;
+    // keep a few blocks of the standard size around for reuse
+    if (b.capacity == RAW_FILE_BLOCK_SIZE && free_blocks.size() < 4) {
+      free_blocks.push_back(std::move(b));
+    }
+    cv.notify_all();
+  }
+  lk.unlock();
+
+  if (bz) {
+    // end of the bz2 stream
+    writeBlock({}, BZ_FINISH);
+  }
+}
+
+// writes the block to the file, through the compressor if there is one. bz_action is ignored for uncompressed files.
+void RawFile::writeBlock(const Block &b, int bz_action) {
+  double start_tms = millis_since_boot();
+  double start_cpu_ms = bz ? thread_cpu_ms() : 0;
+  size_t written = 0;
+  if (!bz) {
+    written = util::safe_fwrite(b.data.get(), 1, b.size, file);
+    assert(written == b.size);
+  } else {
+    bz->next_in = (char*)b.data.get();
+    bz->avail_in = b.size;
+    const int done = bz_action == BZ_FINISH ? BZ_STREAM_END : BZ_RUN_OK;
+    int ret;
+    do {
+      bz->next_out = bz_out.get();
+      bz->avail_out = RAW_FILE_BLOCK_SIZE;
+      ret = BZ2_bzCompress(bz.get(), bz_action);
+      assert(ret >= 0);
+      size_t size = RAW_FILE_BLOCK_SIZE - bz->avail_out;
+      size_t n = util::safe_fwrite(bz_out.get(), 1, size, file);
+      assert(n == size);
+      written += n;
+    } while (bz_action == BZ_RUN ? bz->avail_in > 0 : ret != done);
+    if (bz_action != BZ_RUN) {
+      last_flush_tms = millis_since_boot();
+    }
+  }
+  double write_ms = millis_since_boot() - start_tms;
+  if (write_ms > RAW_FILE_FLUSH_INTERVAL_MS) {
+    LOGW("slow storage: writing %zu bytes took %.1f ms", written, write_ms);
+  }
+
+  std::lock_guard lk(lock);
+  bytes_in += b.size;
+  bytes_out += written;
+  if (bz) {
+    compress_cpu_ms += thread_cpu_ms() - start_cpu_ms;
+  }
+  last_write_ms = write_ms;
+  max_write_ms = std::max(max_write_ms, write_ms);
+}
+
+// adds the messages of the block to the index. write() never splits a message across blocks.
+void RawFile::indexBlock(const Block &b) {
+  kj::ArrayPtr<const capnp::word> words((const capnp::word*)b.data.get(), b.size / sizeof(capnp::word));
+  try {
+    while (index_valid && words.size() > 0) {
+      if (capnp::expectedSizeInWordsFromPrefix(words) > words.size()) {
+        index_valid = false;
+        break;
+      }
+      capnp::FlatArrayMessageReader reader(words);
+      auto event = reader.getRoot<cereal::Event>();
+      const uint64_t size = (reader.getEnd() - words.begin()) * sizeof(capnp::word);
+      const uint64_t mono_time = event.getLogMonoTime();
+      words = kj::arrayPtr(reader.getEnd(), words.end());
+
+      if (index_buckets.empty()) {
+        index_begin_mono_time = mono_time;
+      }
+      uint64_t bucket = mono_time > index_begin_mono_time ? (mono_time - index_begin_mono_time) / SEGMENT_INDEX_BUCKET_NS : 0;
+      if (bucket >= SEGMENT_INDEX_MAX_BUCKETS) {
+        index_valid = false;
+        break;
+      }
+      if (bucket >= index_buckets.size()) {
+        index_buckets.resize(bucket + 1);
+      }
+      index_buckets[bucket].add(index_offset, index_offset + size);
+
+      auto &service = index_services[event.which()];
+      service.which = event.which();
+      ++service.count;
+      service.range.add(index_offset, index_offset + size);
+      index_offset += size;
+    }
+  } catch (const kj::Exception &e) {
+    index_valid = false;
+  }
+}
+
+void RawFile::writeIndex() {
+  if (!index_valid || index_buckets.empty()) {
+    LOGW("%s: not indexed, the log is not a sequence of messages", path.c_str());
+    return;
+  }
+
+  SegmentIndexHeader header = {
+    .magic = SEGMENT_INDEX_MAGIC,
+    .version = SEGMENT_INDEX_VERSION,
+    .log_size = index_offset,
+    .begin_mono_time = index_begin_mono_time,
+    .bucket_ns = SEGMENT_INDEX_BUCKET_NS,
+    .bucket_count = (uint32_t)index_buckets.size(),
+    .service_count = (uint32_t)index_services.size(),
+  };
+  std::string content((const char*)&header, sizeof(header));
+  content.append((const char*)index_buckets.data(), index_buckets.size() * sizeof(SegmentIndexRange));
+  for (auto &[which, service] : index_services) {
+    content.append((const char*)&service, sizeof(service));
+  }
+  if (util::write_file(index_path.c_str(), content.data(), content.size(), O_WRONLY | O_CREAT | O_TRUNC) != 0) {
+    LOGE("failed to write %s", index_path.c_str());
+  }
+}
+
+RawFileStats RawFile::stats() {
+  std::lock_guard lk(lock);
+  return {
+    .queued_bytes = queued_bytes + block.size,
+    .last_write_ms = last_write_ms,
+    .max_write_ms = max_write_ms,
+    .bytes_in = bytes_in,
+    .bytes_out = bytes_out,
+    .compress_cpu_ms = compress_cpu_ms,
+  };
+}
+
 // ***** log metadata *****
 kj::Array<capnp::word> logger_build_init_data() {
   MessageBuilder msg;
@@ -102,11 +364,6 @@ std::string logger_get_route_name() {
   return route_name;
 }
 
-void log_init_data(LoggerState *s) {
-  auto bytes = s->init_data.asBytes();
-  logger_log(s, bytes.begin(), bytes.size(), s->has_qlog);
-}
-
 
 static void lh_log_sentinel(LoggerHandle *h, SentinelType type) {
   MessageBuilder msg;
@@ -120,11 +377,12 @@ static void lh_log_sentinel(LoggerHandle *h, SentinelType type) {
 
 // ***** logging functions *****
 
-void logger_init(LoggerState *s, bool has_qlog) {
+void logger_init(LoggerState *s, bool has_qlog, bool compress) {
   pthread_mutex_init(&s->lock, NULL);
 
   s->part = -1;
   s->has_qlog = has_qlog;
+  s->compress = compress;
   s->route_name = logger_get_route_name();
   s->init_data = logger_build_init_data();
 }
@@ -142,9 +400,12 @@ static LoggerHandle* logger_open(LoggerState *s, const char* root_path) {
   snprintf(h->segment_path, sizeof(h->segment_path),
           "%s/%s--%d", root_path, s->route_name.c_str(), s->part);
 
-  snprintf(h->log_path, sizeof(h->log_path), "%s/rlog", h->segment_path);
-  snprintf(h->qlog_path, sizeof(h->qlog_path), "%s/qlog", h->segment_path);
-  snprintf(h->lock_path, sizeof(h->lock_path), "%s.lock", h->log_path);
+  const char *ext = s->compress ? ".bz2" : "";
+  snprintf(h->log_path, sizeof(h->log_path), "%s/rlog%s", h->segment_path, ext);
+  snprintf(h->qlog_path, sizeof(h->qlog_path), "%s/qlog%s", h->segment_path, ext);
+  snprintf(h->log_index_path, sizeof(h->log_index_path), "%s/rlog.idx", h->segment_path);
+  snprintf(h->qlog_index_path, sizeof(h->qlog_index_path), "%s/qlog.idx", h->segment_path);
+  snprintf(h->lock_path, sizeof(h->lock_path), "%s/rlog.lock", h->segment_path);
   h->end_sentinel_type = SentinelType::END_OF_SEGMENT;
   h->exit_signal = 0;
 
@@ -154,9 +415,9 @@ static LoggerHandle* logger_open(LoggerState *s, const char* root_path) {
   if (lock_file == NULL) return NULL;
   fclose(lock_file);
 
-  h->log = std::make_unique<RawFile>(h->log_path);
+  h->log = std::make_unique<RawFile>(h->log_path, s->compress, h->log_index_path);
   if (s->has_qlog) {
-    h->q_log = std::make_unique<RawFile>(h->qlog_path);
+    h->q_log = std::make_unique<RawFile>(h->qlog_path, s->compress, h->qlog_index_path);
   }
 
   pthread_mutex_init(&h->lock, NULL);
@@ -178,9 +439,7 @@ int logger_next(LoggerState *s, const char* root_path,
     return -1;
   }
 
-  if (s->cur_handle) {
-    lh_close(s->cur_handle);
-  }
+  LoggerHandle* prev_h = s->cur_handle;
   s->cur_handle = next_h;
 
   if (out_segment_path) {
@@ -190,11 +449,18 @@ int logger_next(LoggerState *s, const char* root_path,
     *out_part = s->part;
   }
 
+  // write beginning of log metadata, before other threads can log to the new segment
+  auto bytes = s->init_data.asBytes();
+  lh_log(next_h, bytes.begin(), bytes.size(), s->has_qlog);
+  lh_log_sentinel(next_h, is_start_of_route ? SentinelType::START_OF_ROUTE : SentinelType::START_OF_SEGMENT);
+
   pthread_mutex_unlock(&s->lock);
 
-  // write beginning of log metadata
-  log_init_data(s);
-  lh_log_sentinel(s->cur_handle, is_start_of_route ? SentinelType::START_OF_ROUTE : SentinelType::START_OF_SEGMENT);
+  // closing flushes the writer thread and finishes the files, keep the loggers waiting for s->lock out of it.
+  // nothing logs to the previous handle anymore, except through the references it counts.
+  if (prev_h) {
+    lh_close(prev_h);
+  }
   return 0;
 }
 
@@ -228,6 +494,21 @@ void logger_close(LoggerState *s, ExitHandler *exit_handler) {
   pthread_mutex_unlock(&s->lock);
 }
 
+bool logger_write_stats(LoggerState *s, RawFileStats *stats) {
+  bool ret = false;
+  pthread_mutex_lock(&s->lock);
+  if (s->cur_handle) {
+    pthread_mutex_lock(&s->cur_handle->lock);
+    if (s->cur_handle->log) {
+      *stats = s->cur_handle->log->stats();
+      ret = true;
+    }
+    pthread_mutex_unlock(&s->cur_handle->lock);
+  }
+  pthread_mutex_unlock(&s->lock);
+  return ret;
+}
+
 void lh_log(LoggerHandle* h, uint8_t* data, size_t data_size, bool in_qlog) {
   pthread_mutex_lock(&h->lock);
   assert(h->refcnt > 0);
@@ -3,10 +3,17 @@
 #include <cassert>
 #include <pthread.h>
 
+#include <condition_variable>
 #include <cstdint>
 #include <cstdio>
+#include <deque>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
+#include <bzlib.h>
 #include <capnp/serialize.h>
 #include <kj/array.h>
 
@@ -14,30 +21,83 @@
 #include "common/util.h"
 #include "common/swaglog.h"
 #include "system/hardware/hw.h"
+#include "system/loggerd/segment_index.h"
 
 const std::string LOG_ROOT = Path::log_root();
 
 #define LOGGER_MAX_HANDLES 16
 
+// RawFile copies messages into blocks of this size and writes them out on its own thread
+const size_t RAW_FILE_BLOCK_SIZE = 256 * 1024;
+// a partially filled block is handed to the writer thread after this long
+const double RAW_FILE_FLUSH_INTERVAL_MS = 1000;
+// blocks waiting to be written before RawFile::write waits for the storage
+const size_t RAW_FILE_MAX_QUEUED_BLOCKS = 64;
+// compressed files are flushed at least this often, so everything up to the flush point can be decompressed
+const double RAW_FILE_COMPRESS_FLUSH_INTERVAL_MS = 10000;
+
+struct RawFileStats {
+  size_t queued_bytes;  // bytes waiting for the writer thread
+  double last_write_ms;  // duration of the last block write
+  double max_write_ms;
+  size_t bytes_in;  // bytes passed to write()
+  size_t bytes_out;  // bytes written to the file, less than bytes_in if compressed
+  double compress_cpu_ms;  // CPU time spent compressing
+};
+
 class RawFile {
  public:
-  RawFile(const char* path) {
-    file = util::safe_fopen(path, "wb");
-    assert(file != nullptr);
-  }
-  ~RawFile() {
-    util::safe_fflush(file);
-    int err = fclose(file);
-    assert(err == 0);
-  }
-  inline void write(void* data, size_t size) {
-    int written = util::safe_fwrite(data, 1, size, file);
-    assert(written == size);
-  }
+  // with compress, the file is written as a bz2 stream. if index_path is set, a SegmentIndex is written there on close.
+  RawFile(const char* path, bool compress = false, const char* index_path = nullptr);
+  ~RawFile();
+  void write(void* data, size_t size);
   inline void write(kj::ArrayPtr<capnp::byte> array) { write(array.begin(), array.size()); }
+  RawFileStats stats();
 
  private:
+  struct BlockDeleter {
+    void operator()(uint8_t* p) const { free(p); }
+  };
+  struct Block {
+    std::unique_ptr<uint8_t, BlockDeleter> data;
+    size_t capacity = 0;
+    size_t size = 0;
+  };
+  Block allocBlock(size_t capacity);
+  void queueBlock();
+  void queueBlock(Block &&b);
+  void writerThread();
+  void writeBlock(const Block &b, int bz_action);
+  void indexBlock(const Block &b);
+  void writeIndex();
+
   FILE* file = nullptr;
+  std::string path;
+  // the block being filled by write()
+  Block block;
+  double block_start_tms = 0;
+
+  std::mutex lock;
+  std::condition_variable cv;
+  std::deque<Block> queue;
+  std::vector<Block> free_blocks;
+  size_t queued_bytes = 0;
+  double last_write_ms = 0, max_write_ms = 0;
+  size_t bytes_in = 0, bytes_out = 0;
+  double compress_cpu_ms = 0;
+  bool exit = false;
+
+  // only used by the writer thread
+  std::unique_ptr<bz_stream> bz;
+  std::unique_ptr<char[]> bz_out;
+  double last_flush_tms = 0;
+  std::string index_path;
+  bool index_valid = true;
+  uint64_t index_offset = 0;
+  uint64_t index_begin_mono_time = 0;
+  std::vector<SegmentIndexRange> index_buckets;
+  std::map<uint16_t, SegmentIndexService> index_services;
+  std::thread writer;
 };
 
 typedef cereal::Sentinel::SentinelType SentinelType;
@@ -50,6 +110,8 @@ typedef struct LoggerHandle {
   char segment_path[4096];
   char log_path[4096];
   char qlog_path[4096];
+  char log_index_path[4096];
+  char qlog_index_path[4096];
   char lock_path[4096];
   std::unique_ptr<RawFile> log, q_log;
 } LoggerHandle;
@@ -61,6 +123,7 @@ typedef struct LoggerState {
   std::string route_name;
   char log_name[64];
   bool has_qlog;
+  bool compress;
 
   LoggerHandle handles[LOGGER_MAX_HANDLES];
   LoggerHandle* cur_handle;
@@ -68,7 +131,7 @@ typedef struct LoggerState {
 
 kj::Array<capnp::word> logger_build_init_data();
 std::string logger_get_route_name();
-void logger_init(LoggerState *s, bool has_qlog);
+void logger_init(LoggerState *s, bool has_qlog, bool compress = false);
 int logger_next(LoggerState *s, const char* root_path,
                             char* out_segment_path, size_t out_segment_path_len,
                             int* out_part);
@@ -76,5 +139,7 @@ LoggerHandle* logger_get_handle(LoggerState *s);
 void logger_close(LoggerState *s, ExitHandler *exit_handler=nullptr);
 void logger_log(LoggerState *s, uint8_t* data, size_t data_size, bool in_qlog);
 
+bool logger_write_stats(LoggerState *s, RawFileStats *stats);
+
 void lh_log(LoggerHandle* h, uint8_t* data, size_t data_size, bool in_qlog);
 void lh_close(LoggerHandle* h);
@@ -167,89 +167,141 @@ int handle_encoder_msg(LoggerdState *s, Message *msg, std::string &name, struct
   return bytes_count;
 }
 
-void loggerd_thread() {
-  // setup messaging
-  typedef struct QlogState {
-    std::string name;
-    int counter, freq;
-    bool encoder;
-  } QlogState;
-  std::unordered_map<SubSocket*, QlogState> qlog_states;
-  std::unordered_map<SubSocket*, struct RemoteEncoder> remote_encoders;
-
-  std::unique_ptr<Context> ctx(Context::create());
-  std::unique_ptr<Poller> poller(Poller::create());
-
-  // subscribe to all socks
-  for (const auto& it : services) {
-    const bool encoder = strcmp(it.name+strlen(it.name)-strlen("EncodeData"), "EncodeData") == 0;
-    if (!it.should_log && !encoder) continue;
-    LOGD("logging %s (on port %d)", it.name, it.port);
-
-    SubSocket * sock = SubSocket::create(ctx.get(), it.name);
-    assert(sock != NULL);
-    poller->registerSocket(sock);
-    qlog_states[sock] = {
-      .name = it.name,
-      .counter = 0,
-      .freq = it.decimation,
-      .encoder = encoder,
-    };
-  }
+struct QlogState {
+  std::string name;
+  int counter, freq;
+  bool encoder;
+};
 
-  LoggerdState s;
-  // init logger
-  logger_init(&s.logger, true);
-  logger_rotate(&s);
-  Params().put("CurrentRoute", s.logger.route_name);
+// a subset of the sockets, polled on its own thread
+struct LoggerdShard {
+  int id;
+  bool encoder = false;
+  double frequency = 0;  // summed frequency of its services
+  std::unique_ptr<Poller> poller;
+  std::unordered_map<SubSocket*, QlogState> qlog_states;
+};
 
-  std::map<std::string, EncoderInfo> encoder_infos_dict;
-  for (const auto &cam : cameras_logged) {
-    for (const auto &encoder_info: cam.encoder_infos) {
-      encoder_infos_dict[encoder_info.publish_name] = encoder_info;
-      s.max_waiting++;
-    }
-  }
+void shard_thread(LoggerdState *s, LoggerdShard *shard, std::map<std::string, EncoderInfo> *encoder_infos_dict) {
+  std::unordered_map<SubSocket*, struct RemoteEncoder> remote_encoders;
 
-  uint64_t msg_count = 0, bytes_count = 0;
+  // capped_drains counts the sockets that still had messages after draining 200,
+  // i.e. the shard is falling behind
+  uint64_t msg_count = 0, bytes_count = 0, capped_drains = 0;
   double start_ts = millis_since_boot();
   while (!do_exit) {
     // poll for new messages on all sockets
-    for (auto sock : poller->poll(1000)) {
+    for (auto sock : shard->poller->poll(1000)) {
       if (do_exit) break;
 
       // drain socket
       int count = 0;
-      QlogState &qs = qlog_states[sock];
+      QlogState &qs = shard->qlog_states[sock];
       Message *msg = nullptr;
       while (!do_exit && (msg = sock->receive(true))) {
         const bool in_qlog = qs.freq != -1 && (qs.counter++ % qs.freq == 0);
 
         if (qs.encoder) {
-          s.last_camera_seen_tms = millis_since_boot();
-          bytes_count += handle_encoder_msg(&s, msg, qs.name, remote_encoders[sock], encoder_infos_dict[qs.name]);
+          s->last_camera_seen_tms = millis_since_boot();
+          bytes_count += handle_encoder_msg(s, msg, qs.name, remote_encoders[sock], (*encoder_infos_dict)[qs.name]);
+          rotate_if_needed(s);
         } else {
-          logger_log(&s.logger, (uint8_t *)msg->getData(), msg->getSize(), in_qlog);
+          logger_log(&s->logger, (uint8_t *)msg->getData(), msg->getSize(), in_qlog);
           bytes_count += msg->getSize();
           delete msg;
         }
 
-        rotate_if_needed(&s);
-
         if ((++msg_count % 1000) == 0) {
           double seconds = (millis_since_boot() - start_ts) / 1000.0;
-          LOGD("%lu messages, %.2f msg/sec, %.2f KB/sec", msg_count, msg_count / seconds, bytes_count * 0.001 / seconds);
+          LOGD("shard %d: %lu messages, %.2f msg/sec, %.2f KB/sec, %lu capped drains", shard->id, msg_count,
+               msg_count / seconds, bytes_count * 0.001 / seconds, capped_drains);
+          RawFileStats stats;
+          if (shard->encoder && logger_write_stats(&s->logger, &stats)) {
+            LOGD("rlog: %.2f KB queued, last write %.2f ms, max write %.2f ms, %.2f KB written",
+                 stats.queued_bytes * 0.001, stats.last_write_ms, stats.max_write_ms, stats.bytes_out * 0.001);
+          }
         }
 
         count++;
         if (count >= 200) {
           LOGD("large volume of '%s' messages", qs.name.c_str());
+          ++capped_drains;
           break;
         }
       }
     }
+
+    // segments are only rotated on the encoder shard. it also times out rotation when the cameras are dead.
+    if (shard->encoder) {
+      rotate_if_needed(s);
+    }
   }
 
+  // messaging cleanup
+  for (auto &[sock, qs] : shard->qlog_states) delete sock;
+}
+
+void loggerd_thread() {
+  std::unique_ptr<Context> ctx(Context::create());
+
+  // encoder packets get a shard of their own, the other services are spread over the rest by frequency
+  LoggerdShard shards[LOGGERD_SHARDS];
+  for (int i = 0; i < LOGGERD_SHARDS; ++i) {
+    shards[i].id = i;
+    shards[i].encoder = i == 0;
+    shards[i].poller.reset(Poller::create());
+  }
+
+  std::vector<const service *> logged_services;
+  for (const auto& it : services) {
+    const bool encoder = strcmp(it.name+strlen(it.name)-strlen("EncodeData"), "EncodeData") == 0;
+    if (!it.should_log && !encoder) continue;
+    logged_services.push_back(&it);
+  }
+  std::sort(logged_services.begin(), logged_services.end(), [](auto a, auto b) { return a->frequency > b->frequency; });
+
+  // subscribe to all socks
+  for (const service *it : logged_services) {
+    const bool encoder = strcmp(it->name+strlen(it->name)-strlen("EncodeData"), "EncodeData") == 0;
+    LoggerdShard *shard = &shards[0];
+    if (!encoder) {
+      shard = std::min_element(shards + 1, shards + LOGGERD_SHARDS, [](auto &a, auto &b) { return a.frequency < b.frequency; });
+    }
+    LOGD("logging %s (on port %d) on shard %d", it->name, it->port, shard->id);
+
+    SubSocket * sock = SubSocket::create(ctx.get(), it->name);
+    assert(sock != NULL);
+    shard->poller->registerSocket(sock);
+    shard->frequency += it->frequency;
+    shard->qlog_states[sock] = {
+      .name = it->name,
+      .counter = 0,
+      .freq = it->decimation,
+      .encoder = encoder,
+    };
+  }
+
+  LoggerdState s;
+  // init logger
+  // compressed logs are ready to upload as soon as the segment is closed
+  logger_init(&s.logger, true, Params().getBool("CompressLogs"));
+  logger_rotate(&s);
+  Params().put("CurrentRoute", s.logger.route_name);
+
+  std::map<std::string, EncoderInfo> encoder_infos_dict;
+  for (const auto &cam : cameras_logged) {
+    for (const auto &encoder_info: cam.encoder_infos) {
+      encoder_infos_dict[encoder_info.publish_name] = encoder_info;
+      s.max_waiting++;
+    }
+  }
+
+  std::vector<std::thread> threads;
+  for (auto &shard : shards) {
+    threads.emplace_back(shard_thread, &s, &shard, &encoder_infos_dict);
+  }
+  for (auto &t : threads) t.join();
+
   LOGW("closing logger");
   logger_close(&s.logger, &do_exit);
 
@@ -258,9 +310,6 @@ void loggerd_thread() {
     sync();
     LOGE("sync done");
   }
-
-  // messaging cleanup
-  for (auto &[sock, qs] : qlog_states) delete sock;
 }
 
 int main(int argc, char** argv) {
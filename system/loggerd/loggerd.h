@@ -2,6 +2,7 @@
 
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <cerrno>
@@ -40,6 +41,8 @@ const int MAIN_BITRATE = 10000000;
 
 const bool LOGGERD_TEST = getenv("LOGGERD_TEST");
 const int SEGMENT_LENGTH = LOGGERD_TEST ? atoi(getenv("LOGGERD_SEGMENT_LENGTH")) : 60;
+// threads polling the logged sockets. the first one handles the encoder packets, the rest the other services.
+const int LOGGERD_SHARDS = 3;
 
 class EncoderInfo {
 public:
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+// loggerd writes a sidecar index next to each log when its segment is closed, rlog.idx for rlog or rlog.bz2.
+// it maps coarse logMonoTime buckets and the services to byte ranges of the uncompressed log,
+// so readers can decode only the part of a segment they need.
+//
+// layout: SegmentIndexHeader, bucket_count SegmentIndexRange, service_count SegmentIndexService
+
+const uint32_t SEGMENT_INDEX_MAGIC = 0x78646973;  // "sidx"
+const uint32_t SEGMENT_INDEX_VERSION = 1;
+const uint64_t SEGMENT_INDEX_BUCKET_NS = 250 * 1000000ULL;
+// messages beyond this many buckets from the start of the log are not bucketed, the index is useless then
+const uint32_t SEGMENT_INDEX_MAX_BUCKETS = 100000;
+
+struct SegmentIndexHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t log_size;  // bytes of the uncompressed log
+  uint64_t begin_mono_time;  // start of the first bucket
+  uint64_t bucket_ns;
+  uint32_t bucket_count;
+  uint32_t service_count;
+};
+
+// [begin, end) byte range covering a set of messages
+struct SegmentIndexRange {
+  uint64_t begin = UINT64_MAX;
+  uint64_t end = 0;
+
+  inline void add(uint64_t b, uint64_t e) {
+    begin = std::min(begin, b);
+    end = std::max(end, e);
+  }
+  inline bool empty() const { return begin >= end; }
+};
+
+struct SegmentIndexService {
+  uint16_t which;  // cereal::Event::Which
+  uint16_t reserved;
+  uint32_t count;
+  SegmentIndexRange range;  // from the first message to the end of the last one
+};
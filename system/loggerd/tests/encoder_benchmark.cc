@@ -0,0 +1,94 @@
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "system/loggerd/encoder/ffmpeg_encoder.h"
+
+// encode fps of the PC software encoders for a growing number of codec threads, and the size of a segment.
+// usage: ENCODER_PRESET=veryfast ./encoder_benchmark [frames]
+
+struct Stream {
+  const char *name;
+  cereal::EncodeIndex::Type type;
+  int width, height, bitrate;
+};
+
+// a noise texture that moves every frame, so the codec has real motion to encode
+std::vector<AVFrame *> make_frames(int width, int height, int count) {
+  std::mt19937 rng(0);
+  std::vector<uint8_t> texture((width + count * 4) * height);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width + count * 4; ++x) {
+      texture[y * (width + count * 4) + x] = ((x / 16 + y / 16) % 2) * 128 + rng() % 64;
+    }
+  }
+
+  std::vector<AVFrame *> frames;
+  for (int i = 0; i < count; ++i) {
+    AVFrame *f = av_frame_alloc();
+    f->format = AV_PIX_FMT_YUV420P;
+    f->width = width;
+    f->height = height;
+    int err = av_frame_get_buffer(f, 0);
+    assert(err >= 0);
+    for (int y = 0; y < height; ++y) {
+      memcpy(f->data[0] + y * f->linesize[0], &texture[y * (width + count * 4) + i * 4], width);
+    }
+    for (int y = 0; y < height / 2; ++y) {
+      memset(f->data[1] + y * f->linesize[1], 128, width / 2);
+      memset(f->data[2] + y * f->linesize[2], 128, width / 2);
+    }
+    frames.push_back(f);
+  }
+  return frames;
+}
+
+int main(int argc, char *argv[]) {
+  const int frame_count = argc > 1 ? atoi(argv[1]) : 200;
+  const int ncpu = std::thread::hardware_concurrency();
+  const Stream streams[] = {
+    {"ffvhuff", cereal::EncodeIndex::Type::BIG_BOX_LOSSLESS, 1928, 1208, MAIN_BITRATE},
+    {"libx265", cereal::EncodeIndex::Type::FULL_H_E_V_C, 1928, 1208, MAIN_BITRATE},
+    {"libx264 qcam", cereal::EncodeIndex::Type::QCAMERA_H264, 526, 330, 256000},
+  };
+
+  printf("%d frames, %d cores\n", frame_count, ncpu);
+  printf("%-14s %8s %10s %12s\n", "codec", "threads", "fps", "MB/segment");
+  for (const auto &s : streams) {
+    auto frames = make_frames(s.width, s.height, 20);
+    for (int threads = 1; threads <= ncpu; threads *= 2) {
+      AVCodecContext *ctx = ffmpeg_codec_open(s.type, s.width, s.height, MAIN_FPS, s.bitrate, threads);
+      if (!ctx) {
+        printf("%-14s not available\n", s.name);
+        break;
+      }
+
+      AVPacket *pkt = av_packet_alloc();
+      size_t bytes = 0;
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i <= frame_count; ++i) {
+        AVFrame *f = i < frame_count ? frames[i % frames.size()] : nullptr;
+        if (f) f->pts = i;
+        int err = avcodec_send_frame(ctx, f);
+        assert(err >= 0);
+        while (avcodec_receive_packet(ctx, pkt) == 0) {
+          bytes += pkt->size;
+          av_packet_unref(pkt);
+        }
+      }
+      double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      printf("%-14s %8d %10.1f %12.1f\n", s.name, threads, frame_count / secs,
+             (double)bytes / frame_count * MAIN_FPS * SEGMENT_LENGTH / 1e6);
+
+      av_packet_free(&pkt);
+      avcodec_free_context(&ctx);
+    }
+    for (auto f : frames) av_frame_free(&f);
+  }
+  return 0;
+}
@@ -54,6 +54,24 @@ void verify_segment(const std::string &route_path, int segment, int max_segment,
       }
     }
     REQUIRE(event_cnt == required_event_cnt);
+
+    // the segment index covers the whole log
+    std::string index = util::read_file(log_file + ".idx");
+    REQUIRE(index.size() >= sizeof(SegmentIndexHeader));
+    SegmentIndexHeader header;
+    memcpy(&header, index.data(), sizeof(header));
+    REQUIRE(header.magic == SEGMENT_INDEX_MAGIC);
+    REQUIRE(header.log_size == log.size());
+    REQUIRE(header.bucket_count > 0);
+    REQUIRE(index.size() == sizeof(header) + header.bucket_count * sizeof(SegmentIndexRange) + header.service_count * sizeof(SegmentIndexService));
+    int indexed_cnt = 0;
+    for (int j = 0; j < header.service_count; ++j) {
+      SegmentIndexService service;
+      memcpy(&service, index.data() + sizeof(header) + header.bucket_count * sizeof(SegmentIndexRange) + j * sizeof(service), sizeof(service));
+      REQUIRE(service.range.end <= log.size());
+      if (service.which == cereal::Event::CLOCKS) indexed_cnt = service.count;
+    }
+    REQUIRE(indexed_cnt == required_event_cnt);
   }
 }
 
@@ -145,3 +163,28 @@ TEST_CASE("logger") {
     }
   }
 }
+
+TEST_CASE("RawFile") {
+  const bool compress = GENERATE(false, true);
+  const std::string fn = "/tmp/test_raw_file";
+  std::string expected;
+  {
+    RawFile f(fn.c_str(), compress);
+    // small writes filling several blocks, and writes larger than a block
+    for (size_t size : {100ul, RAW_FILE_BLOCK_SIZE - 1, 4000ul, RAW_FILE_BLOCK_SIZE * 3 + 7, 1ul, RAW_FILE_BLOCK_SIZE}) {
+      std::string data = util::random_string(size);
+      f.write(data.data(), data.size());
+      expected += data;
+    }
+    REQUIRE(f.stats().queued_bytes <= expected.size());
+  }
+  std::string content = util::read_file(fn);
+  if (compress) {
+    std::string out(expected.size(), '\0');
+    unsigned int out_size = out.size();
+    REQUIRE(BZ2_bzBuffToBuffDecompress(out.data(), &out_size, content.data(), content.size(), 0, 0) == BZ_OK);
+    REQUIRE(out_size == expected.size());
+    content = out;
+  }
+  REQUIRE(content == expected);
+}
@@ -111,6 +111,10 @@ class Uploader:
         continue
 
       for name in sorted(names, key=self.get_upload_sort):
+        # the segment index sidecars are for local readers only
+        if name.endswith(".idx"):
+          continue
+
         key = os.path.join(logname, name)
         fn = os.path.join(path, name)
         # skip files already uploaded
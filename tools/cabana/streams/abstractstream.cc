@@ -126,12 +126,13 @@ void AbstractStream::updateLastMsgsTo(double sec) {
   });
 }
 
-void AbstractStream::mergeEvents(std::vector<Event *>::const_iterator first, std::vector<Event *>::const_iterator last) {
+void AbstractStream::mergeEvents(std::vector<Event>::const_iterator first, std::vector<Event>::const_iterator last) {
   size_t memory_size = 0;
   size_t events_cnt = 0;
   for (auto it = first; it != last; ++it) {
-    if ((*it)->which == cereal::Event::Which::CAN) {
-      for (const auto &c : (*it)->event.getCan()) {
+    if (it->which == cereal::Event::Which::CAN) {
+      EventReader reader(*it);
+      for (const auto &c : reader.event.getCan()) {
         memory_size += sizeof(CanEvent) + sizeof(uint8_t) * c.getDat().size();
         ++events_cnt;
       }
@@ -144,9 +145,10 @@ void AbstractStream::mergeEvents(std::vector<Event *>::const_iterator first, std
   std::vector<const CanEvent *> new_events;
   new_events.reserve(events_cnt);
   for (auto it = first; it != last; ++it) {
-    if ((*it)->which == cereal::Event::Which::CAN) {
-      uint64_t ts = (*it)->mono_time;
-      for (const auto &c : (*it)->event.getCan()) {
+    if (it->which == cereal::Event::Which::CAN) {
+      uint64_t ts = it->mono_time;
+      EventReader reader(*it);
+      for (const auto &c : reader.event.getCan()) {
         CanEvent *e = (CanEvent *)ptr;
         e->src = c.getSrc();
         e->address = c.getAddress();
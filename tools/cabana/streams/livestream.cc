@@ -59,8 +59,12 @@ void LiveStream::handleEvent(const char *data, const size_t size) {
   }
 
   std::lock_guard lk(lock);
-  auto &msg = receivedMessages.emplace_back(data, size);
-  receivedEvents.push_back(msg.event);
+  const size_t words = size / sizeof(capnp::word);
+  const capnp::word *msg = receivedMessages.emplace_back(new capnp::word[words]).get();
+  memcpy((void *)msg, data, words * sizeof(capnp::word));
+  capnp::FlatArrayMessageReader reader(kj::arrayPtr(msg, words));
+  auto event = reader.getRoot<cereal::Event>();
+  receivedEvents.emplace_back(event.which(), event.getLogMonoTime(), kj::arrayPtr(msg, reader.getEnd()));
 }
 
 void LiveStream::timerEvent(QTimerEvent *event) {
@@ -28,19 +28,10 @@ private:
   void timerEvent(QTimerEvent *event) override;
   void updateEvents();
 
-  struct Msg {
-    Msg(const char *data, const size_t size) {
-      event = ::new Event(aligned_buf.align(data, size));
-    }
-    ~Msg() { ::delete event; }
-    Event *event;
-    AlignedBuffer aligned_buf;
-  };
-
   std::mutex lock;
   QThread *stream_thread;
-  std::vector<Event *> receivedEvents;
-  std::deque<Msg> receivedMessages;
+  std::vector<Event> receivedEvents;
+  std::deque<std::unique_ptr<capnp::word[]>> receivedMessages;
 
   int timer_id;
   QBasicTimer update_timer;
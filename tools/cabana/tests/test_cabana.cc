@@ -38,10 +38,11 @@ TEST_CASE("Parse can messages") {
   LogReader log;
   REQUIRE(log.load(TEST_RLOG_URL, nullptr, {}, true));
   REQUIRE(log.events.size() > 0);
-  for (auto e : log.events) {
-    if (e->which == cereal::Event::Which::CAN) {
+  for (const auto &e : log.events) {
+    if (e.which == cereal::Event::Which::CAN) {
+      EventReader reader(e);
       std::map<std::pair<uint32_t, QString>, std::vector<double>> values_1;
-      for (const auto &c : e->event.getCan()) {
+      for (const auto &c : reader.event.getCan()) {
         const auto msg = dbc.msg({.source = c.getSrc(), .address = c.getAddress()});
         if (c.getSrc() == 0 && msg) {
           for (auto sig : msg->getSignals()) {
@@ -51,7 +52,7 @@ TEST_CASE("Parse can messages") {
         }
       }
 
-      can_parser.UpdateCans(e->mono_time, e->event.getCan());
+      can_parser.UpdateCans(e.mono_time, reader.event.getCan());
       std::vector<SignalValue> values_2;
       can_parser.query_latest(values_2);
       for (auto &[key, v1] : values_1) {
@@ -178,23 +178,24 @@ void Slider::parseQLog() {
     std::string qlog = it->second.qlog.toStdString();
     if (!qlog.empty() && log.load(qlog, &abort_parse_qlog, {cereal::Event::Which::THUMBNAIL, cereal::Event::Which::CONTROLS_STATE}, true, 0, 3)) {
       if (it == segments.rbegin() && !log.events.empty()) {
-        double max_time = (*(log.events.rbegin()))->mono_time / 1e9 - can->routeStartTime();
+        double max_time = log.events.back().mono_time / 1e9 - can->routeStartTime();
         emit updateMaximumTime(max_time);
       }
       for (auto ev = log.events.cbegin(); ev != log.events.cend() && !abort_parse_qlog; ++ev) {
-        if ((*ev)->which == cereal::Event::Which::THUMBNAIL) {
-          auto thumb = (*ev)->event.getThumbnail();
+        EventReader reader(*ev);
+        if (ev->which == cereal::Event::Which::THUMBNAIL) {
+          auto thumb = reader.event.getThumbnail();
           auto data = thumb.getThumbnail();
           if (QPixmap pm; pm.loadFromData(data.begin(), data.size(), "jpeg")) {
             pm = pm.scaledToHeight(MIN_VIDEO_HEIGHT - THUMBNAIL_MARGIN * 2, Qt::SmoothTransformation);
             std::lock_guard lk(thumbnail_lock);
             thumbnails[thumb.getTimestampEof()] = pm;
           }
-        } else if ((*ev)->which == cereal::Event::Which::CONTROLS_STATE) {
-          auto cs = (*ev)->event.getControlsState();
+        } else if (ev->which == cereal::Event::Which::CONTROLS_STATE) {
+          auto cs = reader.event.getControlsState();
           if (cs.getAlertType().size() > 0 && cs.getAlertText1().size() > 0) {
             std::lock_guard lk(thumbnail_lock);
-            alerts.emplace((*ev)->mono_time, AlertInfo{cs.getAlertStatus(), cs.getAlertText1().cStr(), cs.getAlertText2().cStr()});
+            alerts.emplace(ev->mono_time, AlertInfo{cs.getAlertStatus(), cs.getAlertText1().cStr(), cs.getAlertText2().cStr()});
           }
         }
       }
@@ -1,8 +1,14 @@
 #include "tools/replay/camera.h"
 #include "tools/replay/util.h"
 
+#include <algorithm>
 #include <cassert>
 
+#include "common/timing.h"
+
+// number of frames decode_fps is averaged over
+const int DECODE_FPS_FRAMES = 20;
+
 CameraServer::CameraServer(std::pair<int, int> camera_size[MAX_CAMERAS]) {
   for (int i = 0; i < MAX_CAMERAS; ++i) {
     std::tie(cameras_[i].width, cameras_[i].height) = camera_size[i];
@@ -38,7 +44,16 @@ void CameraServer::cameraThread(Camera &cam) {
   auto read_frame = [&](FrameReader *fr, int frame_id) {
     VisionBuf *yuv_buf = vipc_server_->get_buffer(cam.stream_type);
     assert(yuv_buf);
+    uint64_t start_ts = nanos_since_boot();
     bool ret = fr->get(frame_id, (uint8_t *)yuv_buf->addr);
+    if (ret) {
+      cam.decode_ns += nanos_since_boot() - start_ts;
+      if (++cam.decoded_frames == DECODE_FPS_FRAMES) {
+        cam.decode_fps = cam.decoded_frames / (std::max<uint64_t>(cam.decode_ns, 1) / 1e9);
+        cam.decoded_frames = 0;
+        cam.decode_ns = 0;
+      }
+    }
     return ret ? yuv_buf : nullptr;
   };
 
@@ -46,23 +61,23 @@ void CameraServer::cameraThread(Camera &cam) {
     const auto [fr, eidx] = cam.queue.pop();
     if (!fr) break;
 
-    const int id = eidx.getSegmentId();
-    bool prefetched = (id == cam.cached_id && eidx.getSegmentNum() == cam.cached_seg);
+    const int id = eidx.segment_id;
+    bool prefetched = (id == cam.cached_id && eidx.segment_num == cam.cached_seg);
     auto yuv = prefetched ? cam.cached_buf : read_frame(fr, id);
     if (yuv) {
       VisionIpcBufExtra extra = {
-          .frame_id = eidx.getFrameId(),
-          .timestamp_sof = eidx.getTimestampSof(),
-          .timestamp_eof = eidx.getTimestampEof(),
+          .frame_id = eidx.frame_id,
+          .timestamp_sof = eidx.timestamp_sof,
+          .timestamp_eof = eidx.timestamp_eof,
       };
-      yuv->set_frame_id(eidx.getFrameId());
+      yuv->set_frame_id(eidx.frame_id);
       vipc_server_->send(yuv, &extra);
     } else {
-      rError("camera[%d] failed to get frame: %lu", cam.type, eidx.getSegmentId());
+      rError("camera[%d] failed to get frame: %u", cam.type, eidx.segment_id);
     }
 
     cam.cached_id = id + 1;
-    cam.cached_seg = eidx.getSegmentNum();
+    cam.cached_seg = eidx.segment_num;
     cam.cached_buf = read_frame(fr, cam.cached_id);
 
     --publishing_;
@@ -79,7 +94,8 @@ void CameraServer::pushFrame(CameraType type, FrameReader *fr, const cereal::Enc
   }
 
   ++publishing_;
-  cam.queue.push({fr, eidx});
+  cam.queue.push({fr, {eidx.getSegmentNum(), eidx.getSegmentId(), eidx.getFrameId(),
+                       eidx.getTimestampSof(), eidx.getTimestampEof()}});
 }
 
 void CameraServer::waitForSent() {
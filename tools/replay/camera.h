@@ -12,18 +12,32 @@ public:
   ~CameraServer();
   void pushFrame(CameraType type, FrameReader* fr, const cereal::EncodeIndex::Reader& eidx);
   void waitForSent();
+  // frames the camera's decoder can produce per second, 0 if it has not decoded anything yet
+  inline float decodeFps(CameraType type) const { return cameras_[type].decode_fps; }
 
 protected:
+  // fields of the EncodeIndex, copied since the capnp reader does not outlive pushFrame
+  struct EncodeIdx {
+    uint32_t segment_num;
+    uint32_t segment_id;
+    uint32_t frame_id;
+    uint64_t timestamp_sof;
+    uint64_t timestamp_eof;
+  };
   struct Camera {
     CameraType type;
     VisionStreamType stream_type;
     int width;
     int height;
     std::thread thread;
-    SafeQueue<std::pair<FrameReader*, const cereal::EncodeIndex::Reader>> queue;
+    SafeQueue<std::pair<FrameReader*, EncodeIdx>> queue;
     int cached_id = -1;
     int cached_seg = -1;
     VisionBuf * cached_buf;
+    // decoded frames and the time spent on them since decode_fps was last updated
+    int decoded_frames = 0;
+    uint64_t decode_ns = 0;
+    std::atomic<float> decode_fps = 0;
   };
   void startVipcServer();
   void cameraThread(Camera &cam);
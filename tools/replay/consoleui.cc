@@ -165,9 +165,10 @@ void ConsoleUI::updateStatus() {
   sm.update(0);
 
   if (status != Status::Paused) {
-    auto events = replay->events();
+    const auto &events = replay->events();
     uint64_t current_mono_time = replay->routeStartTime() + replay->currentSeconds() * 1e9;
-    bool playing = !events->empty() && events->back()->mono_time > current_mono_time;
+    bool playing = !events.empty() && !events.rbegin()->second->empty() &&
+                   events.rbegin()->second->back().mono_time > current_mono_time;
     status = playing ? Status::Playing : Status::Waiting;
   }
   auto [status_str, status_color] = status_text[status];
@@ -182,6 +183,10 @@ void ConsoleUI::updateStatus() {
   auto angle_offsets = util::string_format("%.2f|%.2f", p.getAngleOffsetAverageDeg(), p.getAngleOffsetDeg());
   write_item(2, 25, "ANGLE OFFSET(AVG|INSTANT): ", angle_offsets, " deg");
 
+  auto decode_fps = util::string_format("%.1f|%.1f|%.1f", replay->decodeFps(RoadCam), replay->decodeFps(DriverCam),
+                                        replay->decodeFps(WideRoadCam));
+  write_item(1, 50, "DECODE FPS(ROAD|DRIVER|WIDE): ", decode_fps, "");
+
   wrefresh(w[Win::CarState]);
 }
 
@@ -1,6 +1,9 @@
 #include "tools/replay/filereader.h"
 
-#include <fstream>
+#include <sys/mman.h>
+
+#include <cstdio>
+#include <cstring>
 
 #include "common/util.h"
 #include "tools/replay/util.h"
@@ -15,6 +18,54 @@ std::string cacheFilePath(const std::string &url) {
   return cache_path + sha256(getUrlWithoutQuery(url));
 }
 
+namespace {
+
+// readers of the same url may download it at the same time, each writes its own temp file.
+// the renames replace the cache file atomically, it's never seen half written.
+bool writeCacheFile(const std::string &file, const std::string &content) {
+  std::string tmp_file = file + ".XXXXXX";
+  int fd = mkstemp(tmp_file.data());
+  if (fd == -1) return false;
+  close(fd);
+
+  if (util::write_file(tmp_file.c_str(), content.data(), content.size(), O_WRONLY | O_TRUNC) != 0 ||
+      std::rename(tmp_file.c_str(), file.c_str()) != 0) {
+    std::remove(tmp_file.c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+// class MappedFile
+
+MappedFile::MappedFile(const std::string &file) {
+  unique_fd fd = HANDLE_EINTR(open(file.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd == -1) return;
+
+  struct stat st = {};
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) return;
+
+  void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (addr == MAP_FAILED) {
+    rWarning("failed to mmap %s: %s", file.c_str(), strerror(errno));
+    return;
+  }
+  // the whole file is walked once while parsing
+  madvise(addr, st.st_size, MADV_SEQUENTIAL);
+  data_ = (std::byte *)addr;
+  size_ = st.st_size;
+}
+
+MappedFile::~MappedFile() {
+  if (data_) {
+    munmap(data_, size_);
+  }
+}
+
+// class FileReader
+
 std::string FileReader::read(const std::string &file, std::atomic<bool> *abort) {
   const bool is_remote = file.find("https://") == 0;
   const std::string local_file = is_remote ? cacheFilePath(file) : file;
@@ -25,13 +76,26 @@ std::string FileReader::read(const std::string &file, std::atomic<bool> *abort)
   } else if (is_remote) {
     result = download(file, abort);
     if (cache_to_local_ && !result.empty()) {
-      std::ofstream fs(local_file, std::ios::binary | std::ios::out);
-      fs.write(result.data(), result.size());
+      writeCacheFile(local_file, result);
     }
   }
   return result;
 }
 
+std::unique_ptr<MappedFile> FileReader::map(const std::string &file, std::atomic<bool> *abort) {
+  const bool is_remote = file.find("https://") == 0;
+  if (is_remote && !cache_to_local_) return nullptr;
+
+  const std::string local_file = is_remote ? cacheFilePath(file) : file;
+  if (is_remote && !util::file_exists(local_file)) {
+    std::string result = download(file, abort);
+    if (result.empty() || !writeCacheFile(local_file, result)) return nullptr;
+  }
+
+  auto mapped = std::make_unique<MappedFile>(local_file);
+  return mapped->isOpen() ? std::move(mapped) : nullptr;
+}
+
 std::string FileReader::download(const std::string &url, std::atomic<bool> *abort) {
   for (int i = 0; i <= max_retries_ && !(abort && *abort); ++i) {
     if (i > 0) rWarning("download failed, retrying %d", i);
@@ -1,14 +1,32 @@
 #pragma once
 
 #include <atomic>
+#include <memory>
 #include <string>
 
+// read-only mapping of a local file. the data stays valid until the object is destroyed.
+class MappedFile {
+public:
+  MappedFile(const std::string &file);
+  ~MappedFile();
+  inline bool isOpen() const { return data_ != nullptr; }
+  inline const std::byte *data() const { return data_; }
+  inline size_t size() const { return size_; }
+
+private:
+  std::byte *data_ = nullptr;
+  size_t size_ = 0;
+};
+
 class FileReader {
 public:
   FileReader(bool cache_to_local, size_t chunk_size = 0, int retries = 3)
       : cache_to_local_(cache_to_local), chunk_size_(chunk_size), max_retries_(retries) {}
   virtual ~FileReader() {}
   std::string read(const std::string &file, std::atomic<bool> *abort = nullptr);
+  // map local or cached files without copying them to the heap.
+  // returns nullptr if the file is remote and not cached locally.
+  std::unique_ptr<MappedFile> map(const std::string &file, std::atomic<bool> *abort = nullptr);
 
 private:
   std::string download(const std::string &url, std::atomic<bool> *abort);
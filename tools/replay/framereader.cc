@@ -1,9 +1,15 @@
 #include "tools/replay/framereader.h"
 #include "tools/replay/util.h"
 
+#include <algorithm>
 #include <cassert>
 #include "libyuv.h"
 
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 #include "cereal/visionipc/visionbuf.h"
 
 #ifdef __APPLE__
@@ -51,6 +57,15 @@ FrameReader::FrameReader() {
 }
 
 FrameReader::~FrameReader() {
+  if (prefetch_thread_.joinable()) {
+    {
+      std::lock_guard lk(lock_);
+      exit_ = true;
+    }
+    prefetch_cv_.notify_one();
+    prefetch_thread_.join();
+  }
+
   for (AVPacket *pkt : packets) {
     av_packet_free(&pkt);
   }
@@ -126,9 +141,7 @@ bool FrameReader::load(const std::byte *data, size_t size, bool no_hw_decoder, s
     }
   }
 
-  ret = avcodec_open2(decoder_ctx, decoder, nullptr);
-  if (ret < 0) {
-    rError("avcodec_open2 failed %d", ret);
+  if (!openDecoder(decoder)) {
     return false;
   }
 
@@ -141,9 +154,10 @@ bool FrameReader::load(const std::byte *data, size_t size, bool no_hw_decoder, s
       valid_ = (ret == AVERROR_EOF);
       break;
     }
+    if (pkt->flags & AV_PKT_FLAG_KEY) {
+      key_frames_.push_back(packets.size());
+    }
     packets.push_back(pkt);
-    // some stream seems to contain no keyframes
-    key_frames_count_ += pkt->flags & AV_PKT_FLAG_KEY;
   }
   valid_ = valid_ && !packets.empty();
   return valid_;
@@ -174,74 +188,227 @@ bool FrameReader::initHardwareDecoder(AVHWDeviceType hw_device_type) {
   decoder_ctx->hw_device_ctx = av_buffer_ref(hw_device_ctx);
   decoder_ctx->opaque = &hw_pix_fmt;
   decoder_ctx->get_format = get_hw_format;
+  // cached frames hold on to their surfaces, keep the decoder from running out of them
+  decoder_ctx->extra_hw_frames = MAX_FRAME_CACHE_SIZE;
+  return true;
+}
+
+void FrameReader::setCpuDecoding(int threads, const std::vector<int> &cpus) {
+  cpu_threads_ = std::max(0, threads);
+  cpus_ = cpus;
+}
+
+bool FrameReader::openDecoder(const AVCodec *decoder) {
+  const bool cpu_decoding = hw_pix_fmt == AV_PIX_FMT_NONE;
+  if (cpu_decoding && cpu_threads_ != 1) {
+    decoder_ctx->thread_count = cpu_threads_;
+    decoder_ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+  }
+
+#ifdef __linux__
+  // libavcodec starts its threads in avcodec_open2 and they inherit the affinity of this thread,
+  // so pin this thread to the decoder's cores while opening it.
+  cpu_set_t saved_cpus;
+  bool pinned = false;
+  if (cpu_decoding && !cpus_.empty() && pthread_getaffinity_np(pthread_self(), sizeof(saved_cpus), &saved_cpus) == 0) {
+    cpu_set_t decoder_cpus;
+    CPU_ZERO(&decoder_cpus);
+    for (int cpu : cpus_) {
+      CPU_SET(cpu, &decoder_cpus);
+    }
+    pinned = pthread_setaffinity_np(pthread_self(), sizeof(decoder_cpus), &decoder_cpus) == 0;
+    if (!pinned) {
+      rWarning("failed to pin the decoder threads");
+    }
+  }
+#endif
+
+  int ret = avcodec_open2(decoder_ctx, decoder, nullptr);
+
+#ifdef __linux__
+  if (pinned) {
+    pthread_setaffinity_np(pthread_self(), sizeof(saved_cpus), &saved_cpus);
+  }
+#endif
+
+  if (ret < 0) {
+    rError("avcodec_open2 failed %d", ret);
+    return false;
+  }
   return true;
 }
 
+void FrameReader::startPrefetch(int frames) {
+  std::lock_guard lk(lock_);
+  if (!valid_ || prefetch_thread_.joinable() || frames <= 0) return;
+
+  // keep the prefetched frames and the current one
+  prefetch_frames_ = std::min(frames, MAX_FRAME_CACHE_SIZE - 2);
+  cache_size_ = std::max(cache_size_, prefetch_frames_ + 2);
+  prefetch_thread_ = std::thread(&FrameReader::prefetchThread, this);
+}
+
 bool FrameReader::get(int idx, uint8_t *yuv) {
   assert(yuv != nullptr);
   if (!valid_ || idx < 0 || idx >= packets.size()) {
     return false;
   }
-  return decode(idx, yuv);
+
+  bool ret = true;
+  {
+    std::lock_guard lk(lock_);
+    if (AVFrame *frame = findCachedFrame(idx)) {
+      ret = copyBuffers(frame, yuv);
+    } else {
+      ret = decode(idx, yuv);
+    }
+    if (idx != last_get_idx_) {
+      direction_ = idx > last_get_idx_ ? 1 : -1;
+      last_get_idx_ = idx;
+    }
+    prefetch_from_ = idx;
+  }
+  if (prefetch_frames_ > 0) {
+    prefetch_cv_.notify_one();
+  }
+  return ret;
+}
+
+void FrameReader::prefetchThread() {
+  std::unique_lock lk(lock_);
+  while (true) {
+    prefetch_cv_.wait(lk, [this]() { return exit_ || prefetch_from_ != -1; });
+    if (exit_) break;
+
+    const int from = std::exchange(prefetch_from_, -1);
+    for (int i = 1; i <= prefetch_frames_ && prefetch_from_ == -1 && !exit_; ++i) {
+      int idx = from + i * direction_;
+      if (idx < 0 || idx >= packets.size()) break;
+
+      if (!findCachedFrame(idx)) {
+        decode(idx, nullptr);
+        // give get() a chance to take the lock between two frames
+        lk.unlock();
+        std::this_thread::yield();
+        lk.lock();
+      }
+    }
+  }
 }
 
+// must be called with lock_ held. the decoded frame is copied to yuv if it's not null.
 bool FrameReader::decode(int idx, uint8_t *yuv) {
   int from_idx = idx;
-  if (idx != prev_idx + 1 && key_frames_count_ > 1) {
-    // seeking to the nearest key frame
-    for (int i = idx; i >= 0; --i) {
-      if (packets[i]->flags & AV_PKT_FLAG_KEY) {
-        from_idx = i;
-        break;
-      }
+  if (key_frames_.size() > 1) {
+    auto key = std::upper_bound(key_frames_.begin(), key_frames_.end(), idx);
+    from_idx = key == key_frames_.begin() ? 0 : *(--key);
+  }
+  // keep feeding the decoder if idx is ahead in the same GOP, otherwise restart from the key frame.
+  if (next_packet_ < from_idx || idx <= last_frame_) {
+    if (draining_) {
+      avcodec_flush_buffers(decoder_ctx);
+      draining_ = false;
     }
+    ++serial_;
+    next_packet_ = from_idx;
+    last_frame_ = from_idx - 1;
   }
-  prev_idx = idx;
 
-  for (int i = from_idx; i <= idx; ++i) {
-    AVFrame *f = decodeFrame(packets[i]);
-    if (f && i == idx) {
-      return copyBuffers(f, yuv);
+  bool found = false, copied = true;
+  while (last_frame_ < idx) {
+    int ret = 0;
+    AVFrame *f = receiveFrame(&ret);
+    if (ret == AVERROR(EAGAIN)) {
+      if (next_packet_ < packets.size()) {
+        sendPacket(next_packet_++);
+      } else if (!draining_) {
+        // end of the stream, flush out the delayed frames
+        avcodec_send_packet(decoder_ctx, nullptr);
+        draining_ = true;
+      } else {
+        break;
+      }
+      continue;
+    }
+    if (ret != 0) break;
+    if (!f) continue;
+
+    // frames come out in decode order, count them if the pts got lost
+    const int64_t n = packets.size();
+    if (f->pts != AV_NOPTS_VALUE && f->pts / n != serial_) continue;
+    const int i = f->pts != AV_NOPTS_VALUE ? f->pts % n : last_frame_ + 1;
+    last_frame_ = i;
+    // keep the tail of the decoded frames, scrubbing back usually needs them next.
+    if (i > idx - cache_size_ && !findCachedFrame(i)) {
+      cacheFrame(i, f);
+    }
+    // convert straight into the caller's buffer, the cache only holds a reference to the decoded frame
+    if (i == idx && yuv) {
+      copied = copyBuffers(f, yuv);
     }
+    found = found || i == idx;
   }
-  return false;
+  return found && copied;
 }
 
-AVFrame *FrameReader::decodeFrame(AVPacket *pkt) {
+bool FrameReader::sendPacket(int idx) {
+  AVPacket *pkt = packets[idx];
+  pkt->pts = serial_ * packets.size() + idx;
   int ret = avcodec_send_packet(decoder_ctx, pkt);
   if (ret < 0) {
     rError("Error sending a packet for decoding: %d", ret);
-    return nullptr;
+    return false;
   }
+  return true;
+}
 
+// returns the decoded frame, or nullptr with the error in ret. AVERROR(EAGAIN) means more packets are needed.
+AVFrame *FrameReader::receiveFrame(int *ret) {
   av_frame_.reset(av_frame_alloc());
-  ret = avcodec_receive_frame(decoder_ctx, av_frame_.get());
-  if (ret != 0) {
-    rError("avcodec_receive_frame error: %d", ret);
+  *ret = avcodec_receive_frame(decoder_ctx, av_frame_.get());
+  if (*ret != 0) {
+    if (*ret != AVERROR(EAGAIN) && *ret != AVERROR_EOF) {
+      rError("avcodec_receive_frame error: %d", *ret);
+    }
     return nullptr;
   }
 
-  if (av_frame_->format == hw_pix_fmt) {
-    hw_frame.reset(av_frame_alloc());
-    if ((ret = av_hwframe_transfer_data(hw_frame.get(), av_frame_.get(), 0)) < 0) {
-      rError("error transferring the data from GPU to CPU");
-      return nullptr;
-    }
-    return hw_frame.get();
-  } else {
-    return av_frame_.get();
+  return av_frame_.get();
+}
+
+AVFrame *FrameReader::findCachedFrame(int idx) {
+  auto it = std::find_if(cache_.begin(), cache_.end(), [idx](auto &f) { return f.first == idx; });
+  if (it == cache_.end()) return nullptr;
+
+  cache_.splice(cache_.begin(), cache_, it);
+  return cache_.front().second.get();
+}
+
+void FrameReader::cacheFrame(int idx, AVFrame *f) {
+  if (cache_.size() >= cache_size_) {
+    cache_.pop_back();
   }
+  cache_.emplace_front(idx, av_frame_clone(f));
 }
 
 bool FrameReader::copyBuffers(AVFrame *f, uint8_t *yuv) {
   assert(f != nullptr && yuv != nullptr);
   uint8_t *y = yuv;
   uint8_t *uv = y + width * height;
-  if (hw_pix_fmt == HW_PIX_FMT) {
-    for (int i = 0; i < height/2; i++) {
-      memcpy(y + (i*2 + 0)*width, f->data[0] + (i*2 + 0)*f->linesize[0], width);
-      memcpy(y + (i*2 + 1)*width, f->data[0] + (i*2 + 1)*f->linesize[0], width);
-      memcpy(uv + i*width, f->data[1] + i*f->linesize[1], width);
+  if (f->format == HW_PIX_FMT) {
+    // the decoder outputs NV12, download it from the GPU straight into the caller's buffer.
+    // the buffer is wrapped, av_hwframe_transfer_data allocates a frame of its own if it has no buf.
+    std::unique_ptr<AVFrame, AVFrameDeleter> dst(av_frame_alloc());
+    dst->format = AV_PIX_FMT_NV12;
+    dst->width = f->width;
+    dst->height = f->height;
+    dst->buf[0] = av_buffer_create(yuv, getYUVSize(), [](void *, uint8_t *) {}, nullptr, 0);
+    dst->data[0] = y;
+    dst->data[1] = uv;
+    dst->linesize[0] = dst->linesize[1] = width;
+    if (!dst->buf[0] || av_hwframe_transfer_data(dst.get(), f, 0) < 0) {
+      rError("error transferring the data from GPU to CPU");
+      return false;
     }
   } else {
     libyuv::I420ToNV12(f->data[0], f->linesize[0],
@@ -251,5 +418,6 @@ bool FrameReader::copyBuffers(AVFrame *f, uint8_t *yuv) {
                        uv, width,
                        width, height);
   }
+  bytes_copied_ += getYUVSize();
   return true;
 }
@@ -1,7 +1,11 @@
 #pragma once
 
+#include <condition_variable>
+#include <list>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "tools/replay/filereader.h"
@@ -15,6 +19,11 @@ struct AVFrameDeleter {
   void operator()(AVFrame* frame) const { av_frame_free(&frame); }
 };
 
+// number of decoded frames kept by default, e.g. for stepping back a frame while scrubbing
+const int DEFAULT_FRAME_CACHE_SIZE = 2;
+// the hardware decoder's frames stay on the GPU while cached, its surface pool is grown by this many
+const int MAX_FRAME_CACHE_SIZE = 8;
+
 class FrameReader {
 public:
   FrameReader();
@@ -22,30 +31,66 @@ public:
   bool load(const std::string &url, bool no_hw_decoder = false, std::atomic<bool> *abort = nullptr, bool local_cache = false,
             int chunk_size = -1, int retries = 0);
   bool load(const std::byte *data, size_t size, bool no_hw_decoder = false, std::atomic<bool> *abort = nullptr);
+  // threads of the CPU decoder, 0 picks one per core. if cpus is not empty, the decoder threads are pinned to them.
+  // must be called before load, it has no effect on the hardware decoder.
+  void setCpuDecoding(int threads, const std::vector<int> &cpus = {});
   bool get(int idx, uint8_t *yuv);
+  // decode up to `frames` frames ahead of the last one requested, in the playback direction, on a background thread
+  void startPrefetch(int frames);
   int getYUVSize() const { return width * height * 3 / 2; }
   size_t getFrameCount() const { return packets.size(); }
   bool valid() const { return valid_; }
+  // bytes written to the callers' buffers, one NV12 image per frame returned
+  size_t bytesCopied() const { return bytes_copied_; }
 
   int width = 0, height = 0;
   int aligned_width = 0, aligned_height = 0;
 
 private:
   bool initHardwareDecoder(AVHWDeviceType hw_device_type);
+  bool openDecoder(const AVCodec *decoder);
   bool decode(int idx, uint8_t *yuv);
-  AVFrame * decodeFrame(AVPacket *pkt);
+  bool sendPacket(int idx);
+  AVFrame *receiveFrame(int *ret);
   bool copyBuffers(AVFrame *f, uint8_t *yuv);
+  void cacheFrame(int idx, AVFrame *f);
+  AVFrame *findCachedFrame(int idx);
+  void prefetchThread();
 
   std::vector<AVPacket*> packets;
-  std::unique_ptr<AVFrame, AVFrameDeleter>av_frame_, hw_frame;
+  // indices of the key frames, in ascending order
+  std::vector<int> key_frames_;
+  std::unique_ptr<AVFrame, AVFrameDeleter>av_frame_;
   AVFormatContext *input_ctx = nullptr;
   AVCodecContext *decoder_ctx = nullptr;
-  int key_frames_count_ = 0;
   bool valid_ = false;
   AVIOContext *avio_ctx_ = nullptr;
 
+  // protects the decoder and the frame cache, which are shared with the prefetch thread
+  std::mutex lock_;
+  // references to decoded frames, most recently used first. they are converted to NV12 only when requested,
+  // the hardware decoder's frames are downloaded from the GPU then.
+  std::list<std::pair<int, std::unique_ptr<AVFrame, AVFrameDeleter>>> cache_;
+  int cache_size_ = DEFAULT_FRAME_CACHE_SIZE;
+  size_t bytes_copied_ = 0;
+  std::thread prefetch_thread_;
+  std::condition_variable prefetch_cv_;
+  int prefetch_frames_ = 0;
+  int prefetch_from_ = -1;
+  int last_get_idx_ = -1;
+  int direction_ = 1;
+  bool exit_ = false;
+
   AVPixelFormat hw_pix_fmt = AV_PIX_FMT_NONE;
   AVBufferRef *hw_device_ctx = nullptr;
-  int prev_idx = -1;
+  int cpu_threads_ = 1;
+  std::vector<int> cpus_;
+
+  // frame threading delays the output, so the decoder is fed ahead of the frames received from it.
+  // packets are sent with pts = serial * frame count + index, the frames of a previous run are dropped by their serial.
+  int next_packet_ = 0;
+  int last_frame_ = -1;
+  int64_t serial_ = 0;
+  bool draining_ = false;
   inline static std::atomic<bool> has_hw_decoder = true;
 };
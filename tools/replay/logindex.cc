@@ -0,0 +1,197 @@
+#include "tools/replay/logindex.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <optional>
+#include <type_traits>
+
+#include "common/util.h"
+#include "tools/replay/filereader.h"
+
+namespace {
+
+const char INDEX_MAGIC[8] = {'L', 'O', 'G', 'I', 'N', 'D', 'E', 'X'};
+const uint32_t INDEX_VERSION = 1;
+
+// remote logs never change. local ones are identified by size and modification time.
+struct SourceStamp {
+  uint64_t size = 0;
+  int64_t mtime = 0;
+};
+
+SourceStamp sourceStamp(const std::string &url) {
+  SourceStamp stamp;
+  struct stat st = {};
+  if (url.find("https://") != 0 && stat(url.c_str(), &st) == 0) {
+    stamp.size = st.st_size;
+    stamp.mtime = st.st_mtime;
+  }
+  return stamp;
+}
+
+template <class T>
+void write(std::ofstream &fs, const T &v) {
+  static_assert(std::is_trivially_copyable<T>::value);
+  fs.write((const char *)&v, sizeof(T));
+}
+
+template <class T>
+T read(std::ifstream &fs) {
+  T v = {};
+  fs.read((char *)&v, sizeof(T));
+  return v;
+}
+
+void writeString(std::ofstream &fs, const std::string &s) {
+  write<uint32_t>(fs, s.size());
+  fs.write(s.data(), s.size());
+}
+
+// bytes left to read in fs, 0 once it failed
+uint64_t remaining(std::ifstream &fs, uint64_t file_size) {
+  const std::streamoff pos = fs.tellg();
+  return pos < 0 ? 0 : file_size - std::min<uint64_t>(pos, file_size);
+}
+
+// a count read from the file, or nothing if fewer than count records of at least record_size bytes are left.
+// a truncated or corrupt index must not make the caller allocate whatever it says.
+std::optional<uint64_t> readCount(std::ifstream &fs, uint64_t count, uint64_t file_size, uint64_t record_size) {
+  if (!fs.good() || count > remaining(fs, file_size) / record_size) return std::nullopt;
+  return count;
+}
+
+std::optional<std::string> readString(std::ifstream &fs, uint64_t file_size) {
+  auto size = readCount(fs, read<uint32_t>(fs), file_size, 1);
+  if (!size) return std::nullopt;
+  std::string s(*size, '\0');
+  fs.read(s.data(), s.size());
+  return s;
+}
+
+}  // namespace
+
+std::string logIndexFilePath(const std::string &url) {
+  return cacheFilePath(url) + ".idx";
+}
+
+bool LogIndex::load(const std::string &url) {
+  std::ifstream fs(logIndexFilePath(url), std::ios::binary | std::ios::in | std::ios::ate);
+  if (!fs.is_open()) return false;
+  const uint64_t file_size = fs.tellg();
+  fs.seekg(0);
+
+  char magic[sizeof(INDEX_MAGIC)] = {};
+  fs.read(magic, sizeof(magic));
+  const SourceStamp stamp = sourceStamp(url);
+  if (memcmp(magic, INDEX_MAGIC, sizeof(magic)) != 0 || read<uint32_t>(fs) != INDEX_VERSION ||
+      read<uint64_t>(fs) != stamp.size || read<int64_t>(fs) != stamp.mtime) {
+    return false;
+  }
+
+  words = read<uint64_t>(fs);
+  begin_mono_time = read<uint64_t>(fs);
+  end_mono_time = read<uint64_t>(fs);
+
+  auto entry_count = readCount(fs, read<uint64_t>(fs), file_size, sizeof(Entry));
+  if (!entry_count) return false;
+  entries.resize(*entry_count);
+  fs.read((char *)entries.data(), entries.size() * sizeof(Entry));
+
+  for (uint32_t i = 0, n = read<uint32_t>(fs); i < n && fs.good(); ++i) {
+    auto which = read<cereal::Event::Which>(fs);
+    counts[which] = read<uint32_t>(fs);
+  }
+
+  const uint64_t timeline_record_size = sizeof(uint64_t) + sizeof(cereal::Event::Which) + sizeof(bool) +
+                                        sizeof(cereal::ControlsState::AlertStatus) + sizeof(cereal::ControlsState::AlertSize) + sizeof(uint32_t);
+  auto timeline_count = readCount(fs, read<uint32_t>(fs), file_size, timeline_record_size);
+  if (!timeline_count) return false;
+  timeline.resize(*timeline_count);
+  for (auto &e : timeline) {
+    e.mono_time = read<uint64_t>(fs);
+    e.which = read<cereal::Event::Which>(fs);
+    e.enabled = read<bool>(fs);
+    e.alert_status = read<cereal::ControlsState::AlertStatus>(fs);
+    e.alert_size = read<cereal::ControlsState::AlertSize>(fs);
+    auto alert_type = readString(fs, file_size);
+    if (!alert_type) return false;
+    e.alert_type = std::move(*alert_type);
+  }
+  return fs.good();
+}
+
+bool LogIndex::save(const std::string &url) const {
+  const std::string index_file = logIndexFilePath(url);
+  // replay and cabana may index the same log at the same time, each writes its own temp file
+  std::string tmp_file = index_file + ".XXXXXX";
+  int fd = mkstemp(tmp_file.data());
+  if (fd == -1) return false;
+  close(fd);
+
+  std::ofstream fs(tmp_file, std::ios::binary | std::ios::out | std::ios::trunc);
+  if (!fs.is_open()) {
+    std::remove(tmp_file.c_str());
+    return false;
+  }
+
+  const SourceStamp stamp = sourceStamp(url);
+  fs.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  write(fs, INDEX_VERSION);
+  write(fs, stamp.size);
+  write(fs, stamp.mtime);
+
+  write(fs, words);
+  write(fs, begin_mono_time);
+  write(fs, end_mono_time);
+
+  static_assert(std::is_trivially_copyable<Entry>::value);
+  write<uint64_t>(fs, entries.size());
+  fs.write((const char *)entries.data(), entries.size() * sizeof(Entry));
+
+  write<uint32_t>(fs, counts.size());
+  for (const auto &[which, cnt] : counts) {
+    write(fs, which);
+    write(fs, cnt);
+  }
+
+  write<uint32_t>(fs, timeline.size());
+  for (const auto &e : timeline) {
+    write(fs, e.mono_time);
+    write(fs, e.which);
+    write(fs, e.enabled);
+    write(fs, e.alert_status);
+    write(fs, e.alert_size);
+    writeString(fs, e.alert_type);
+  }
+
+  fs.close();
+  if (!fs.good() || std::rename(tmp_file.c_str(), index_file.c_str()) != 0) {
+    std::remove(tmp_file.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::vector<LogIndex::TimelineEvent> LogIndex::buildTimeline(const std::vector<Event> &events) {
+  std::vector<TimelineEvent> timeline;
+  int prev_cs = -1;
+  for (const Event &e : events) {
+    if (e.which == cereal::Event::Which::CONTROLS_STATE) {
+      EventReader reader(e);
+      auto cs = reader.event.getControlsState();
+      if (prev_cs == -1 || timeline[prev_cs].enabled != cs.getEnabled() ||
+          timeline[prev_cs].alert_status != cs.getAlertStatus() || timeline[prev_cs].alert_type != cs.getAlertType().cStr()) {
+        prev_cs = timeline.size();
+        timeline.push_back({e.mono_time, e.which, cs.getEnabled(), cs.getAlertStatus(), cs.getAlertSize(), cs.getAlertType().cStr()});
+      }
+    } else if (e.which == cereal::Event::Which::USER_FLAG) {
+      timeline.push_back({.mono_time = e.mono_time, .which = e.which});
+    }
+  }
+  return timeline;
+}
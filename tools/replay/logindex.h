@@ -0,0 +1,45 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "tools/replay/logreader.h"
+
+// sidecar index of a log, stored next to the download cache (see cacheFilePath).
+// it lets a log be opened again without parsing every message,
+// and the timeline be drawn without loading the log at all.
+struct LogIndex {
+  struct Entry {
+    uint64_t mono_time;
+    uint64_t offset;  // in words, from the start of the decompressed log
+    uint32_t size;    // in words
+    cereal::Event::Which which;
+    bool frame;
+    uint8_t reserved = 0;  // the entries are written as they are, leave no padding uninitialized
+  };
+  static_assert(sizeof(Entry) == 24);
+
+  // a userFlag, or a controlsState whose engagement or alert differs from the previous one
+  struct TimelineEvent {
+    uint64_t mono_time;
+    cereal::Event::Which which;
+    bool enabled;
+    cereal::ControlsState::AlertStatus alert_status;
+    cereal::ControlsState::AlertSize alert_size;
+    std::string alert_type;
+  };
+
+  bool load(const std::string &url);
+  bool save(const std::string &url) const;
+  static std::vector<TimelineEvent> buildTimeline(const std::vector<Event> &events);
+
+  uint64_t words = 0;  // size of the decompressed log
+  uint64_t begin_mono_time = 0;
+  uint64_t end_mono_time = 0;
+  std::vector<Entry> entries;  // sorted by Event::lessThan
+  std::map<cereal::Event::Which, uint32_t> counts;
+  std::vector<TimelineEvent> timeline;
+};
+
+std::string logIndexFilePath(const std::string &url);
@@ -1,111 +1,390 @@
 #include "tools/replay/logreader.h"
 
+#include <bzlib.h>
+
 #include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <tuple>
+
+#include "common/queue.h"
+#include "common/util.h"
+#include "system/loggerd/segment_index.h"
+#include "tools/replay/logindex.h"
 #include "tools/replay/util.h"
 
-Event::Event(const kj::ArrayPtr<const capnp::word> &amsg, bool frame) : reader(amsg), frame(frame) {
-  words = kj::ArrayPtr<const capnp::word>(amsg.begin(), reader.getEnd());
-  event = reader.getRoot<cereal::Event>();
-  which = event.which();
-  mono_time = event.getLogMonoTime();
-
-  // 1) Send video data at t=timestampEof/timestampSof
-  // 2) Send encodeIndex packet at t=logMonoTime
-  if (frame) {
-    auto idx = capnp::AnyStruct::Reader(event).getPointerSection()[0].getAs<cereal::EncodeIndex>();
-    // C2 only has eof set, and some older routes have neither
-    uint64_t sof = idx.getTimestampSof();
-    uint64_t eof = idx.getTimestampEof();
-    if (sof > 0) {
-      mono_time = sof;
-    } else if (eof > 0) {
-      mono_time = eof;
+namespace {
+
+// narrows [*begin, *end) to the messages the segment index maps to the time range and the allowed services
+bool segmentIndexRange(const std::string &index_file, size_t log_size, const std::pair<uint64_t, uint64_t> &time_range,
+                       const std::set<cereal::Event::Which> &allow, size_t *begin, size_t *end) {
+  std::string content = util::read_file(index_file);
+  if (content.size() < sizeof(SegmentIndexHeader)) return false;
+
+  SegmentIndexHeader header;
+  memcpy(&header, content.data(), sizeof(header));
+  const size_t expected_size = sizeof(header) + header.bucket_count * sizeof(SegmentIndexRange) +
+                               header.service_count * sizeof(SegmentIndexService);
+  if (header.magic != SEGMENT_INDEX_MAGIC || header.version != SEGMENT_INDEX_VERSION || header.log_size != log_size ||
+      header.bucket_count == 0 || header.bucket_ns == 0 || content.size() != expected_size) {
+    return false;
+  }
+
+  std::vector<SegmentIndexRange> buckets(header.bucket_count);
+  memcpy(buckets.data(), content.data() + sizeof(header), buckets.size() * sizeof(SegmentIndexRange));
+  std::vector<SegmentIndexService> services(header.service_count);
+  memcpy(services.data(), content.data() + sizeof(header) + buckets.size() * sizeof(SegmentIndexRange),
+         services.size() * sizeof(SegmentIndexService));
+
+  auto bucket_of = [&](uint64_t mono_time) -> uint64_t {
+    return mono_time > header.begin_mono_time ? (mono_time - header.begin_mono_time) / header.bucket_ns : 0;
+  };
+  // frames are timed by their start of frame, a little before the encodeIdx is logged. take one more bucket.
+  const uint64_t first = bucket_of(time_range.first);
+  const uint64_t last = std::min<uint64_t>(bucket_of(time_range.second) + 1, buckets.size() - 1);
+  SegmentIndexRange range;
+  for (uint64_t i = first; i <= last; ++i) {
+    if (!buckets[i].empty()) range.add(buckets[i].begin, buckets[i].end);
+  }
+
+  if (!allow.empty()) {
+    SegmentIndexRange services_range;
+    for (const auto &service : services) {
+      if (allow.count((cereal::Event::Which)service.which)) {
+        services_range.add(service.range.begin, service.range.end);
+      }
     }
+    range.begin = std::max(range.begin, services_range.begin);
+    range.end = std::min(range.end, services_range.end);
   }
+
+  *begin = range.empty() ? 0 : range.begin;
+  *end = range.empty() ? 0 : std::min<uint64_t>(range.end, log_size);
+  return true;
 }
 
+}  // namespace
+
 // class LogReader
 
-LogReader::LogReader(size_t memory_pool_block_size) {
-#ifdef HAS_MEMORY_RESOURCE
-  const size_t buf_size = sizeof(Event) * memory_pool_block_size;
-  pool_buffer_ = ::operator new(buf_size);
-  mbr_ = new std::pmr::monotonic_buffer_resource(pool_buffer_, buf_size);
-#endif
-  events.reserve(memory_pool_block_size);
+LogReader::LogReader(size_t reserve_size) {
+  events.reserve(reserve_size);
 }
 
-LogReader::~LogReader() {
-  for (Event *e : events) {
-    delete e;
+bool LogReader::load(const std::string &url, std::atomic<bool> *abort,
+                     const std::set<cereal::Event::Which> &allow,
+                     bool local_cache, int chunk_size, int retries) {
+  const bool is_bz2 = url.find(".bz2") != std::string::npos;
+  const bool is_remote = url.find("https://") == 0;
+
+  // the index is written next to the download cache, so it's only used along with it
+  LogIndex index;
+  const bool has_index = local_cache && index.load(url);
+  index_url_ = local_cache && !has_index ? url : "";
+
+  if (is_bz2 && is_remote && !has_index && !(local_cache && util::file_exists(cacheFilePath(url)))) {
+    // decompress and parse while downloading
+    for (int i = 0; i <= retries && !(abort && *abort); ++i) {
+      if (i > 0) rWarning("download failed, retrying %d", i);
+      if (loadStream(url, allow, abort, local_cache)) {
+        return sortEvents(allow, abort);
+      }
+      events.clear();
+      blocks_.clear();
+      buffers_.clear();
+    }
+    return false;
+  }
+
+  // local and cached files are parsed in place (uncompressed) or decompressed straight from the mapping (bz2)
+  FileReader reader(local_cache, chunk_size, retries);
+  mapped_ = reader.map(url, abort);
+  if (!mapped_) {
+    raw_ = reader.read(url, abort);
+    if (raw_.empty()) return false;
+  }
+
+  const std::byte *data = mapped_ ? mapped_->data() : (const std::byte *)raw_.data();
+  size_t size = mapped_ ? mapped_->size() : raw_.size();
+  if (is_bz2) {
+    raw_ = decompressBZ2(data, size, abort);
+    mapped_.reset();
+    if (raw_.empty()) return false;
+
+    data = (const std::byte *)raw_.data();
+    size = raw_.size();
   }
 
-#ifdef HAS_MEMORY_RESOURCE
-  delete mbr_;
-  ::operator delete(pool_buffer_);
-#endif
+  if (has_index) {
+    if (index.words == size / sizeof(capnp::word) && loadFromIndex(data, index, allow, abort)) {
+      return true;
+    }
+    rWarning("outdated log index, rebuilding it");
+    events.clear();
+    index_url_ = local_cache ? url : "";
+  }
+  return parse(data, size, allow, abort);
 }
 
-bool LogReader::load(const std::string &url, std::atomic<bool> *abort,
-                     const std::set<cereal::Event::Which> &allow,
-                     bool local_cache, int chunk_size, int retries) {
-  raw_ = FileReader(local_cache, chunk_size, retries).read(url, abort);
-  if (raw_.empty()) return false;
+bool LogReader::load(const std::string &url, std::pair<uint64_t, uint64_t> time_range,
+                     const std::set<cereal::Event::Which> &allow, std::atomic<bool> *abort, bool local_cache) {
+  FileReader reader(local_cache);
+  mapped_ = reader.map(url, abort);
+  if (!mapped_) {
+    raw_ = reader.read(url, abort);
+    if (raw_.empty()) return false;
+  }
 
-  if (url.find(".bz2") != std::string::npos) {
-    raw_ = decompressBZ2(raw_, abort);
+  const std::byte *data = mapped_ ? mapped_->data() : (const std::byte *)raw_.data();
+  size_t size = mapped_ ? mapped_->size() : raw_.size();
+  std::string log_file = url;
+  if (const size_t pos = url.rfind(".bz2"); pos != std::string::npos) {
+    raw_ = decompressBZ2(data, size, abort);
+    mapped_.reset();
     if (raw_.empty()) return false;
+
+    data = (const std::byte *)raw_.data();
+    size = raw_.size();
+    log_file = url.substr(0, pos);
+  }
+
+  // the index covers the uncompressed log. loggerd writes it next to the log, it's not uploaded.
+  size_t begin = 0, end = size;
+  if (url.find("https://") != 0 && segmentIndexRange(log_file + ".idx", size, time_range, allow, &begin, &end)) {
+    rDebug("segment index: decoding %zu of %zu bytes", end - begin, size);
   }
-  return parse(allow, abort);
+  if (begin >= end) return false;
+
+  parse(data + begin, end - begin, allow, abort);
+  events.erase(std::remove_if(events.begin(), events.end(), [&](const Event &e) {
+    return e.mono_time < time_range.first || e.mono_time > time_range.second;
+  }), events.end());
+  return !events.empty();
 }
 
 bool LogReader::load(const std::byte *data, size_t size, std::atomic<bool> *abort) {
   raw_.assign((const char *)data, size);
-  return parse({}, abort);
+  return parse((const std::byte *)raw_.data(), raw_.size(), {}, abort);
 }
 
-bool LogReader::parse(const std::set<cereal::Event::Which> &allow, std::atomic<bool> *abort) {
-  try {
-    kj::ArrayPtr<const capnp::word> words((const capnp::word *)raw_.data(), raw_.size() / sizeof(capnp::word));
-    while (words.size() > 0 && !(abort && *abort)) {
-#ifdef HAS_MEMORY_RESOURCE
-      Event *evt = new (mbr_) Event(words);
-#else
-      Event *evt = new Event(words);
-#endif
-      if (!allow.empty() && allow.find(evt->which) == allow.end()) {
-        delete evt;
-        words = kj::arrayPtr(evt->reader.getEnd(), words.end());
-        continue;
+bool LogReader::loadStream(const std::string &url, const std::set<cereal::Event::Which> &allow,
+                           std::atomic<bool> *abort, bool local_cache) {
+  // an empty chunk marks the end of the download. the download waits while STREAM_MAX_QUEUED bytes are
+  // queued, so a slow decoder holds back the transfer instead of buffering the whole compressed log.
+  SafeQueue<std::string> chunks;
+  std::mutex queued_lock;
+  std::condition_variable queued_cv;
+  size_t queued_bytes = 0;
+  std::atomic<bool> stop_download = false;
+  bool download_success = false;
+  std::thread download_thread([&]() {
+    const std::string cache_file = cacheFilePath(url);
+    const std::string tmp_file = cache_file + ".tmp";
+    std::ofstream fs;
+    if (local_cache) {
+      fs.open(tmp_file, std::ios::binary | std::ios::out);
+    }
+    download_success = httpGetStream(url, [&](const char *data, size_t size) {
+      if (size > 0) {
+        {
+          std::unique_lock lk(queued_lock);
+          queued_cv.wait(lk, [&]() { return queued_bytes < STREAM_MAX_QUEUED || stop_download; });
+          queued_bytes += size;
+        }
+        chunks.push(std::string(data, size));
+        if (fs.is_open()) fs.write(data, size);
       }
+      return !stop_download;
+    }, abort);
 
-      // Add encodeIdx packet again as a frame packet for the video stream
-      if (evt->which == cereal::Event::ROAD_ENCODE_IDX ||
-          evt->which == cereal::Event::DRIVER_ENCODE_IDX ||
-          evt->which == cereal::Event::WIDE_ROAD_ENCODE_IDX) {
+    if (fs.is_open()) {
+      fs.close();
+      if (!download_success || !fs.good() || std::rename(tmp_file.c_str(), cache_file.c_str()) != 0) {
+        std::remove(tmp_file.c_str());
+      }
+    }
+    chunks.push({});
+  });
 
-#ifdef HAS_MEMORY_RESOURCE
-        Event *frame_evt = new (mbr_) Event(words, true);
-#else
-        Event *frame_evt = new Event(words, true);
-#endif
+  bz_stream strm = {};
+  int bzerror = BZ2_bzDecompressInit(&strm, 0, 0);
+  assert(bzerror == BZ_OK);
 
-        events.push_back(frame_evt);
+  // decompressed data goes into blocks that are never reallocated, so the events can point into them.
+  // a message that does not fit into the current block is moved to the start of the next one.
+  char *block = nullptr;
+  size_t capacity = 0, filled = 0, parsed = 0;
+  try {
+    for (std::string chunk = chunks.pop(); !chunk.empty(); chunk = chunks.pop()) {
+      {
+        std::lock_guard lk(queued_lock);
+        queued_bytes -= chunk.size();
       }
+      queued_cv.notify_one();
+      strm.next_in = chunk.data();
+      strm.avail_in = chunk.size();
+      while (strm.avail_in > 0 && bzerror == BZ_OK && !(abort && *abort)) {
+        if (filled == capacity) {
+          const size_t tail = filled - parsed;
+          const size_t block_words = std::max(STREAM_BLOCK_SIZE, tail * 2) / sizeof(capnp::word) + 1;
+          char *new_block = (char *)blocks_.emplace_back(new capnp::word[block_words]).get();
+          if (tail > 0) {
+            memcpy(new_block, block + parsed, tail);
+          }
+          const uint64_t total_out = strm.total_out_lo32 | ((uint64_t)strm.total_out_hi32 << 32);
+          const capnp::word *begin = (const capnp::word *)new_block;
+          buffers_.push_back({begin, begin + block_words, (total_out - tail) / sizeof(capnp::word)});
+          block = new_block;
+          capacity = block_words * sizeof(capnp::word);
+          filled = tail;
+          parsed = 0;
+        }
+
+        strm.next_out = block + filled;
+        strm.avail_out = capacity - filled;
+        bzerror = BZ2_bzDecompress(&strm);
+        filled = capacity - strm.avail_out;
 
-      words = kj::arrayPtr(evt->reader.getEnd(), words.end());
-      events.push_back(evt);
+        kj::ArrayPtr<const capnp::word> words((const capnp::word *)(block + parsed), (filled - parsed) / sizeof(capnp::word));
+        parsed += parseEvents(words, allow, abort) * sizeof(capnp::word);
+      }
+      if (bzerror != BZ_OK || (abort && *abort)) break;
+    }
+  } catch (const kj::Exception &e) {
+    rWarning("failed to parse log : %s", e.getDescription().cStr());
+    bzerror = BZ_DATA_ERROR;
+  }
+
+  {
+    std::lock_guard lk(queued_lock);
+    stop_download = true;
+  }
+  queued_cv.notify_one();
+  download_thread.join();
+  BZ2_bzDecompressEnd(&strm);
+
+  if (bzerror != BZ_STREAM_END) {
+    if (download_success && !(abort && *abort)) {
+      rWarning("decompressBZ2 error : content is corrupt");
+    }
+    return false;
+  }
+  if (parsed != filled) {
+    rWarning("read %zu events from corrupt log", events.size());
+    index_url_.clear();
+  }
+  log_words_ = (strm.total_out_lo32 | ((uint64_t)strm.total_out_hi32 << 32)) / sizeof(capnp::word);
+  return download_success;
+}
+
+bool LogReader::loadFromIndex(const std::byte *data, const LogIndex &index,
+                              const std::set<cereal::Event::Which> &allow, std::atomic<bool> *abort) {
+  const capnp::word *words = (const capnp::word *)data;
+  for (const auto &e : index.entries) {
+    if (e.offset + e.size > index.words) return false;
+
+    if (allow.empty() || allow.find(e.which) != allow.end()) {
+      events.emplace_back(e.which, e.mono_time, kj::arrayPtr(words + e.offset, e.size), e.frame);
+    }
+  }
+  return !events.empty() && !(abort && *abort);
+}
+
+bool LogReader::parse(const std::byte *data, size_t size, const std::set<cereal::Event::Which> &allow, std::atomic<bool> *abort) {
+  kj::ArrayPtr<const capnp::word> words((const capnp::word *)data, size / sizeof(capnp::word));
+  buffers_ = {{words.begin(), words.end(), 0}};
+  log_words_ = words.size();
+  try {
+    if (parseEvents(words, allow, abort) < words.size() && !(abort && *abort)) {
+      rWarning("failed to parse log : the last message is truncated");
+      if (!events.empty()) {
+        rWarning("read %zu events from corrupt log", events.size());
+      }
+      index_url_.clear();
     }
   } catch (const kj::Exception &e) {
     rWarning("failed to parse log : %s", e.getDescription().cStr());
     if (!events.empty()) {
       rWarning("read %zu events from corrupt log", events.size());
     }
+    index_url_.clear();
   }
+  return sortEvents(allow, abort);
+}
+
+size_t LogReader::parseEvents(kj::ArrayPtr<const capnp::word> words, const std::set<cereal::Event::Which> &allow,
+                              std::atomic<bool> *abort) {
+  const capnp::word *begin = words.begin();
+  while (words.size() > 0 && !(abort && *abort)) {
+    // stop at an incomplete message
+    if (capnp::expectedSizeInWordsFromPrefix(words) > words.size()) break;
 
-  if (!events.empty() && !(abort && *abort)) {
-    std::sort(events.begin(), events.end(), Event::lessThan());
-    return true;
+    capnp::FlatArrayMessageReader reader(words);
+    auto event = reader.getRoot<cereal::Event>();
+    auto which = event.which();
+    auto msg = kj::arrayPtr(words.begin(), reader.getEnd());
+    words = kj::arrayPtr(reader.getEnd(), words.end());
+    if (index_url_.empty() && !allow.empty() && allow.find(which) == allow.end()) {
+      continue;
+    }
+
+    events.emplace_back(which, event.getLogMonoTime(), msg);
+
+    // Add encodeIdx packet again as a frame packet for the video stream
+    if (which == cereal::Event::ROAD_ENCODE_IDX ||
+        which == cereal::Event::DRIVER_ENCODE_IDX ||
+        which == cereal::Event::WIDE_ROAD_ENCODE_IDX) {
+      // 1) Send video data at t=timestampEof/timestampSof
+      // 2) Send encodeIndex packet at t=logMonoTime
+      auto idx = capnp::AnyStruct::Reader(event).getPointerSection()[0].getAs<cereal::EncodeIndex>();
+      // C2 only has eof set, and some older routes have neither
+      uint64_t sof = idx.getTimestampSof();
+      uint64_t eof = idx.getTimestampEof();
+      uint64_t mono_time = sof > 0 ? sof : (eof > 0 ? eof : event.getLogMonoTime());
+      events.emplace_back(which, mono_time, msg, true);
+    }
+  }
+  return words.begin() - begin;
+}
+
+bool LogReader::sortEvents(const std::set<cereal::Event::Which> &allow, std::atomic<bool> *abort) {
+  if (events.empty() || (abort && *abort)) return false;
+
+  std::sort(events.begin(), events.end(), Event::lessThan());
+  if (!index_url_.empty()) {
+    saveIndex();
+    if (!allow.empty()) {
+      events.erase(std::remove_if(events.begin(), events.end(), [&](const Event &e) {
+        return allow.find(e.which) == allow.end();
+      }), events.end());
+    }
+  }
+  return !events.empty();
+}
+
+void LogReader::saveIndex() {
+  LogIndex index;
+  index.words = log_words_;
+  index.begin_mono_time = events.front().mono_time;
+  index.end_mono_time = events.back().mono_time;
+  index.entries.reserve(events.size());
+  for (const Event &e : events) {
+    auto buf = std::find_if(buffers_.begin(), buffers_.end(), [&](auto &b) {
+      return e.data >= std::get<0>(b) && e.data < std::get<1>(b);
+    });
+    assert(buf != buffers_.end());
+    uint64_t offset = std::get<2>(*buf) + (e.data - std::get<0>(*buf));
+    index.entries.push_back({e.mono_time, offset, e.size, e.which, e.frame});
+    if (!e.frame) {
+      ++index.counts[e.which];
+    }
+  }
+  index.timeline = LogIndex::buildTimeline(events);
+  if (!index.save(index_url_)) {
+    rWarning("failed to write log index for %s", index_url_.c_str());
   }
-  return false;
 }
@@ -1,11 +1,7 @@
 #pragma once
 
-#if __has_include(<memory_resource>)
-#define HAS_MEMORY_RESOURCE 1
-#include <memory_resource>
-#endif
-
 #include <set>
+#include <tuple>
 
 #include "cereal/gen/cpp/log.capnp.h"
 #include "system/camerad/cameras/camera_common.h"
@@ -13,55 +9,71 @@
 
 const CameraType ALL_CAMERAS[] = {RoadCam, DriverCam, WideRoadCam};
 const int MAX_CAMERAS = std::size(ALL_CAMERAS);
-const int DEFAULT_EVENT_MEMORY_POOL_BLOCK_SIZE = 65000;
+const int DEFAULT_EVENTS_RESERVE_SIZE = 65000;
+const size_t STREAM_BLOCK_SIZE = 16 * 1024 * 1024;
+// compressed bytes downloaded ahead of the decompression when streaming a remote log
+const size_t STREAM_MAX_QUEUED = 8 * 1024 * 1024;
+
+struct LogIndex;
 
+// a compact index entry of one message in the log, the message itself stays in the LogReader's buffer.
+// the capnp reader is built on access with EventReader.
 class Event {
 public:
-  Event(cereal::Event::Which which, uint64_t mono_time) : reader(kj::ArrayPtr<capnp::word>{}) {
-    // construct a dummy Event for binary search, e.g std::upper_bound
-    this->which = which;
-    this->mono_time = mono_time;
-  }
-  Event(const kj::ArrayPtr<const capnp::word> &amsg, bool frame = false);
-  inline kj::ArrayPtr<const capnp::byte> bytes() const { return words.asBytes(); }
+  Event(cereal::Event::Which which, uint64_t mono_time, const kj::ArrayPtr<const capnp::word> &words = {}, bool frame = false)
+      : mono_time(mono_time), data(words.begin()), size(words.size()), which(which), frame(frame) {}
+  inline kj::ArrayPtr<const capnp::word> words() const { return {data, size}; }
+  inline kj::ArrayPtr<const capnp::byte> bytes() const { return words().asBytes(); }
 
   struct lessThan {
-    inline bool operator()(const Event *l, const Event *r) {
-      return l->mono_time < r->mono_time || (l->mono_time == r->mono_time && l->which < r->which);
+    inline bool operator()(const Event &l, const Event &r) const {
+      return l.mono_time < r.mono_time || (l.mono_time == r.mono_time && l.which < r.which);
     }
   };
 
-#if HAS_MEMORY_RESOURCE
-  void *operator new(size_t size, std::pmr::monotonic_buffer_resource *mbr) {
-    return mbr->allocate(size);
-  }
-  void operator delete(void *ptr) {
-    // No-op. memory used by EventMemoryPool increases monotonically until the logReader is destroyed.
-  }
-#endif
-
   uint64_t mono_time;
+  const capnp::word *data;
+  uint32_t size;
   cereal::Event::Which which;
-  cereal::Event::Reader event;
-  capnp::FlatArrayMessageReader reader;
-  kj::ArrayPtr<const capnp::word> words;
   bool frame;
 };
 
+// must outlive the readers obtained from `event`
+struct EventReader {
+  EventReader(const Event &e) : reader(e.words()), event(reader.getRoot<cereal::Event>()) {}
+  capnp::FlatArrayMessageReader reader;
+  cereal::Event::Reader event;
+};
+
 class LogReader {
 public:
-  LogReader(size_t memory_pool_block_size = DEFAULT_EVENT_MEMORY_POOL_BLOCK_SIZE);
-  ~LogReader();
+  LogReader(size_t reserve_size = DEFAULT_EVENTS_RESERVE_SIZE);
   bool load(const std::string &url, std::atomic<bool> *abort = nullptr, const std::set<cereal::Event::Which> &allow = {},
             bool local_cache = false, int chunk_size = -1, int retries = 0);
   bool load(const std::byte *data, size_t size, std::atomic<bool> *abort = nullptr);
-  std::vector<Event*> events;
+  // loads the events with mono_time in [time_range.first, time_range.second]. if loggerd wrote a segment index
+  // next to the log, only the byte range it maps the time range and the allowed services to is decoded.
+  // the index is only looked up next to local logs, remote logs are downloaded and decoded in full.
+  bool load(const std::string &url, std::pair<uint64_t, uint64_t> time_range,
+            const std::set<cereal::Event::Which> &allow = {}, std::atomic<bool> *abort = nullptr, bool local_cache = false);
+  std::vector<Event> events;
 
 private:
-  bool parse(const std::set<cereal::Event::Which> &allow, std::atomic<bool> *abort);
+  bool loadStream(const std::string &url, const std::set<cereal::Event::Which> &allow, std::atomic<bool> *abort, bool local_cache);
+  bool loadFromIndex(const std::byte *data, const LogIndex &index, const std::set<cereal::Event::Which> &allow, std::atomic<bool> *abort);
+  bool parse(const std::byte *data, size_t size, const std::set<cereal::Event::Which> &allow, std::atomic<bool> *abort);
+  size_t parseEvents(kj::ArrayPtr<const capnp::word> words, const std::set<cereal::Event::Which> &allow, std::atomic<bool> *abort);
+  bool sortEvents(const std::set<cereal::Event::Which> &allow, std::atomic<bool> *abort);
+  void saveIndex();
+
+  // events point into the mapped file, the raw_ buffer or the stream blocks
+  std::unique_ptr<MappedFile> mapped_;
   std::string raw_;
-#ifdef HAS_MEMORY_RESOURCE
-  std::pmr::monotonic_buffer_resource *mbr_ = nullptr;
-  void *pool_buffer_ = nullptr;
-#endif
+  std::vector<std::unique_ptr<capnp::word[]>> blocks_;
+
+  // set if the index should be written after parsing. all events are kept until then, regardless of the allow list.
+  std::string index_url_;
+  // [begin, end) of every decompressed buffer and its offset in the log, in words
+  std::vector<std::tuple<const capnp::word *, const capnp::word *, uint64_t>> buffers_;
+  uint64_t log_words_ = 0;
 };
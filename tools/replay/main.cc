@@ -17,6 +17,8 @@ int main(int argc, char *argv[]) {
       {"qcam", REPLAY_FLAG_QCAMERA, "load qcamera"},
       {"no-hw-decoder", REPLAY_FLAG_NO_HW_DECODER, "disable HW video decoding"},
       {"no-vipc", REPLAY_FLAG_NO_VIPC, "do not output video"},
+      {"prefetch", REPLAY_FLAG_PREFETCH_FRAMES, "decode video frames ahead on a background thread"},
+      {"pin-decoders", REPLAY_FLAG_PIN_DECODERS, "pin each camera's CPU decoder threads to its own cores"},
       {"all", REPLAY_FLAG_ALL_SERVICES, "do output all messages including " + base_blacklist.join(", ") + 
                                         ". this may causes issues when used along with UI"}
   };
@@ -29,6 +31,11 @@ int main(int argc, char *argv[]) {
   parser.addOption({{"b", "block"}, "blacklist of services to send", "block"});
   parser.addOption({{"c", "cache"}, "cache <n> segments in memory. default is 5", "n"});
   parser.addOption({{"s", "start"}, "start from <seconds>", "seconds"});
+  parser.addOption({{"j", "jobs"}, "download and decode up to <n> segments at the same time. default is 3", "n"});
+  parser.addOption({"decode-threads", "decode each camera with <n> threads when CPU decoding", "n"});
+  parser.addOption({"lockstep", "publish in lockstep with the consumers: after each <trigger> message, "
+                    "wait for their <ack> message, e.g. roadEncodeIdx:modelV2,cameraOdometry:liveLocationKalman",
+                    "trigger:ack,..."});
   parser.addOption({"demo", "use a demo route instead of providing your own"});
   parser.addOption({"data_dir", "local directory with routes", "data_dir"});
   parser.addOption({"prefix", "set OPENPILOT_PREFIX", "prefix"});
@@ -46,6 +53,18 @@ int main(int argc, char *argv[]) {
   QStringList allow = parser.value("allow").isEmpty() ? QStringList{} : parser.value("allow").split(",");
   QStringList block = parser.value("block").isEmpty() ? QStringList{} : parser.value("block").split(",");
 
+  // the consumers publish the ack services, so replay must not
+  std::vector<std::pair<std::string, std::string>> lockstep;
+  QStringList lockstep_pairs = parser.value("lockstep").isEmpty() ? QStringList{} : parser.value("lockstep").split(",");
+  for (const QString &pair : lockstep_pairs) {
+    QStringList services = pair.split(":");
+    if (services.size() != 2) {
+      parser.showHelp();
+    }
+    lockstep.push_back({services[0].toStdString(), services[1].toStdString()});
+    block << services[1];
+  }
+
   uint32_t replay_flags = REPLAY_FLAG_NONE;
   for (const auto &[name, flag, _] : flags) {
     if (parser.isSet(name)) {
@@ -63,6 +82,15 @@ int main(int argc, char *argv[]) {
   if (!parser.value("c").isEmpty()) {
     replay->setSegmentCacheLimit(parser.value("c").toInt());
   }
+  if (!parser.value("jobs").isEmpty()) {
+    replay->setMaxLoadingSegments(parser.value("jobs").toInt());
+  }
+  if (!parser.value("decode-threads").isEmpty()) {
+    replay->setDecodeThreads(parser.value("decode-threads").toInt());
+  }
+  if (!lockstep.empty() && !replay->setLockstep(lockstep)) {
+    return 0;
+  }
   if (!replay->load()) {
     return 0;
   }
@@ -8,6 +8,7 @@
 #include "common/params.h"
 #include "common/timing.h"
 #include "system/hardware/hw.h"
+#include "tools/replay/logindex.h"
 #include "tools/replay/util.h"
 
 Replay::Replay(QString route, QStringList allow, QStringList block, QStringList base_blacklist, SubMaster *sm_, uint32_t flags, QString data_dir, QObject *parent)
@@ -48,8 +49,6 @@ Replay::Replay(QString route, QStringList allow, QStringList block, QStringList
     pm = std::make_unique<PubMaster>(s);
   }
   route_ = std::make_unique<Route>(route, data_dir);
-  events_ = std::make_unique<std::vector<Event *>>();
-  new_events_ = std::make_unique<std::vector<Event *>>();
 }
 
 Replay::~Replay() {
@@ -151,37 +150,43 @@ void Replay::buildTimeline() {
   };
 
   for (auto it = segments_.cbegin(); it != segments_.cend() && !exit_; ++it) {
-    LogReader log;
-    if (!log.load(route_->at(it->first).qlog.toStdString(), &exit_,
-                  {cereal::Event::Which::CONTROLS_STATE, cereal::Event::Which::USER_FLAG},
-                  !hasFlag(REPLAY_FLAG_NO_FILE_CACHE), 0, 3)) continue;
-
-    for (const Event *e : log.events) {
-      if (e->which == cereal::Event::Which::CONTROLS_STATE) {
-        auto cs = e->event.getControlsState();
+    // use the timeline stored in the log index, only load the log if there is none yet
+    const std::string qlog = route_->at(it->first).qlog.toStdString();
+    const bool local_cache = !hasFlag(REPLAY_FLAG_NO_FILE_CACHE);
+    std::vector<LogIndex::TimelineEvent> timeline_events;
+    if (LogIndex index; local_cache && index.load(qlog)) {
+      timeline_events = std::move(index.timeline);
+    } else {
+      LogReader log;
+      if (!log.load(qlog, &exit_, {cereal::Event::Which::CONTROLS_STATE, cereal::Event::Which::USER_FLAG},
+                    local_cache, 0, 3)) continue;
+      timeline_events = LogIndex::buildTimeline(log.events);
+    }
 
-        if (engaged != cs.getEnabled()) {
+    for (const auto &e : timeline_events) {
+      if (e.which == cereal::Event::Which::CONTROLS_STATE) {
+        if (engaged != e.enabled) {
           if (engaged) {
             std::lock_guard lk(timeline_lock);
-            timeline.push_back({toSeconds(engaged_begin), toSeconds(e->mono_time), TimelineType::Engaged});
+            timeline.push_back({toSeconds(engaged_begin), toSeconds(e.mono_time), TimelineType::Engaged});
           }
-          engaged_begin = e->mono_time;
-          engaged = cs.getEnabled();
+          engaged_begin = e.mono_time;
+          engaged = e.enabled;
         }
 
-        if (alert_type != cs.getAlertType().cStr() || alert_status != cs.getAlertStatus()) {
+        if (alert_type != e.alert_type || alert_status != e.alert_status) {
           if (!alert_type.empty() && alert_size != cereal::ControlsState::AlertSize::NONE) {
             std::lock_guard lk(timeline_lock);
-            timeline.push_back({toSeconds(alert_begin), toSeconds(e->mono_time), timeline_types[(int)alert_status]});
+            timeline.push_back({toSeconds(alert_begin), toSeconds(e.mono_time), timeline_types[(int)alert_status]});
           }
-          alert_begin = e->mono_time;
-          alert_type = cs.getAlertType().cStr();
-          alert_size = cs.getAlertSize();
-          alert_status = cs.getAlertStatus();
+          alert_begin = e.mono_time;
+          alert_type = e.alert_type;
+          alert_size = e.alert_size;
+          alert_status = e.alert_status;
         }
-      } else if (e->which == cereal::Event::Which::USER_FLAG) {
+      } else if (e.which == cereal::Event::Which::USER_FLAG) {
         std::lock_guard lk(timeline_lock);
-        timeline.push_back({toSeconds(e->mono_time), toSeconds(e->mono_time), TimelineType::UserFlag});
+        timeline.push_back({toSeconds(e.mono_time), toSeconds(e.mono_time), TimelineType::UserFlag});
       }
     }
   }
@@ -216,6 +221,14 @@ void Replay::pause(bool pause) {
   });
 }
 
+int Replay::decodeThreadsPerCamera() const {
+  if (decode_threads > 0) return decode_threads;
+  // the readers of every loaded segment get these threads, but only the playing segment decodes.
+  // so the cores are split between the cameras of the route, not between its segments.
+  const int cameras = 1 + hasFlag(REPLAY_FLAG_DCAM) + hasFlag(REPLAY_FLAG_ECAM);
+  return std::max(1, (int)std::max(1u, std::thread::hardware_concurrency()) / cameras);
+}
+
 void Replay::setCurrentSegment(int n) {
   if (current_segment_.exchange(n) != n) {
     QMetaObject::invokeMethod(this, &Replay::queueSegment, Qt::QueuedConnection);
@@ -245,16 +258,23 @@ void Replay::queueSegment() {
     ++end;
   }
 
-  // load one segment at a time
+  // load up to max_loading_segments at a time. the current segment first,
+  // then the segments ahead in playback order, then the ones behind it.
+  std::vector<SegmentMap::iterator> load_order;
   for (auto it = cur; it != end; ++it) {
-    auto &[n, seg] = *it;
-    if ((seg && !seg->isLoaded()) || !seg) {
-      if (!seg) {
-        rDebug("loading segment %d...", n);
-        seg = std::make_unique<Segment>(n, route_->at(n), flags_, allow_list);
-        QObject::connect(seg.get(), &Segment::loadFinished, this, &Replay::segmentLoadFinished);
-      }
-      break;
+    load_order.push_back(it);
+  }
+  for (auto it = cur; it != begin;) {
+    load_order.push_back(--it);
+  }
+  int loading = std::count_if(begin, end, [](auto &e) { return e.second && !e.second->isLoaded(); });
+  for (auto it = load_order.begin(); it != load_order.end() && loading < max_loading_segments; ++it) {
+    auto &[n, seg] = **it;
+    if (!seg) {
+      rDebug("loading segment %d...", n);
+      seg = std::make_unique<Segment>(n, route_->at(n), flags_, allow_list, decodeThreadsPerCamera());
+      QObject::connect(seg.get(), &Segment::loadFinished, this, &Replay::segmentLoadFinished);
+      ++loading;
     }
   }
 
@@ -274,11 +294,9 @@ void Replay::queueSegment() {
 
 void Replay::mergeSegments(const SegmentMap::iterator &begin, const SegmentMap::iterator &end) {
   std::vector<int> segments_need_merge;
-  size_t new_events_size = 0;
   for (auto it = begin; it != end; ++it) {
     if (it->second && it->second->isLoaded()) {
       segments_need_merge.push_back(it->first);
-      new_events_size += it->second->log->events.size();
     }
   }
 
@@ -289,20 +307,14 @@ void Replay::mergeSegments(const SegmentMap::iterator &begin, const SegmentMap::
       if (i != segments_need_merge.size() - 1) s += ", ";
     }
     rDebug("merge segments %s", s.c_str());
-    new_events_->clear();
-    new_events_->reserve(new_events_size);
-    for (int n : segments_need_merge) {
-      const auto &e = segments_[n]->log->events;
-      if (e.size() > 0) {
-        auto insert_from = e.begin();
-        if (new_events_->size() > 0 && (*insert_from)->which == cereal::Event::Which::INIT_DATA) ++insert_from;
-        auto middle = new_events_->insert(new_events_->end(), insert_from, e.end());
-        std::inplace_merge(new_events_->begin(), middle, new_events_->end(), Event::lessThan());
-      }
-    }
 
+    // segments are kept sorted on their own and merged while streaming,
+    // so only the index needs to be updated here.
     updateEvents([&]() {
-      events_.swap(new_events_);
+      events_.clear();
+      for (int n : segments_need_merge) {
+        events_[n] = &segments_[n]->log->events;
+      }
       segments_merged_ = segments_need_merge;
       return true;
     });
@@ -316,20 +328,25 @@ void Replay::startStream(const Segment *cur_segment) {
   const auto &events = cur_segment->log->events;
 
   // get route start time from initData
-  auto it = std::find_if(events.begin(), events.end(), [](auto e) { return e->which == cereal::Event::Which::INIT_DATA; });
-  route_start_ts_ = it != events.end() ? (*it)->mono_time : events[0]->mono_time;
+  auto it = std::find_if(events.begin(), events.end(), [](auto &e) { return e.which == cereal::Event::Which::INIT_DATA; });
+  route_start_ts_ = it != events.end() ? it->mono_time : events[0].mono_time;
   cur_mono_time_ += route_start_ts_;
 
   // write CarParams
-  it = std::find_if(events.begin(), events.end(), [](auto e) { return e->which == cereal::Event::Which::CAR_PARAMS; });
+  it = std::find_if(events.begin(), events.end(), [](auto &e) { return e.which == cereal::Event::Which::CAR_PARAMS; });
   if (it != events.end()) {
-    car_fingerprint_ = (*it)->event.getCarParams().getCarFingerprint();
+    EventReader reader(*it);
+    car_fingerprint_ = reader.event.getCarParams().getCarFingerprint();
     capnp::MallocMessageBuilder builder;
-    builder.setRoot((*it)->event.getCarParams());
+    builder.setRoot(reader.event.getCarParams());
     auto words = capnp::messageToFlatArray(builder);
     auto bytes = words.asBytes();
-    Params().put("CarParams", (const char *)bytes.begin(), bytes.size());
-    Params().put("CarParamsPersistent", (const char *)bytes.begin(), bytes.size());
+    std::string car_params((const char *)bytes.begin(), bytes.size());
+    Params params;
+    Params::Batch batch(params);
+    batch.put("CarParams", car_params);
+    batch.put("CarParamsPersistent", car_params);
+    batch.commit();
   } else {
     rWarning("failed to read CarParams from current segment");
   }
@@ -355,6 +372,74 @@ void Replay::startStream(const Segment *cur_segment) {
   timeline_future = QtConcurrent::run(this, &Replay::buildTimeline);
 }
 
+bool Replay::setLockstep(const std::vector<std::pair<std::string, std::string>> &triggers) {
+  auto event_struct = capnp::Schema::from<cereal::Event>().asStruct();
+  std::vector<const char*> acks(sockets_.size(), nullptr);
+  for (const auto &[trigger, ack] : triggers) {
+    auto trigger_it = std::find_if(std::begin(services), std::end(services), [&](auto &it) { return trigger == it.name; });
+    auto ack_it = std::find_if(std::begin(services), std::end(services), [&](auto &it) { return ack == it.name; });
+    if (trigger_it == std::end(services) || ack_it == std::end(services)) {
+      rError("invalid lockstep service %s:%s", trigger.c_str(), ack.c_str());
+      return false;
+    }
+    uint16_t which = event_struct.getFieldByName(trigger_it->name).getProto().getDiscriminantValue();
+    uint16_t ack_which = event_struct.getFieldByName(ack_it->name).getProto().getDiscriminantValue();
+    if (sockets_[ack_which] != nullptr) {
+      rError("%s is published by replay, block it to use it as lockstep ack", ack_it->name);
+      return false;
+    }
+    acks[which] = ack_it->name;
+  }
+  lockstep_acks_ = acks;
+  return true;
+}
+
+// frameId of the event's struct, if it has one
+static std::optional<uint32_t> eventFrameId(cereal::Event::Reader event) {
+  capnp::DynamicStruct::Reader evt = event;
+  KJ_IF_MAYBE(field, evt.which()) {
+    auto value = evt.get(*field);
+    if (value.getType() == capnp::DynamicValue::STRUCT) {
+      auto data = value.as<capnp::DynamicStruct>();
+      KJ_IF_MAYBE(frame_id, data.getSchema().findFieldByName("frameId")) {
+        return data.get(*frame_id).as<uint32_t>();
+      }
+    }
+  }
+  return std::nullopt;
+}
+
+bool Replay::waitForAck(SubMaster &ack_sm, const Event *e, uint64_t published_ns) {
+  // the consumer of a frame can only reply once the frame is out
+  if (e->frame && camera_server_) {
+    camera_server_->waitForSent();
+  }
+
+  // the ack must be sent after the trigger, and carry its frameId if both have one.
+  // anything else is a late reply to an earlier trigger or not a reply at all.
+  const char *ack = lockstep_acks_[e->which];
+  const auto frame_id = eventFrameId(EventReader(*e).event);
+  uint64_t start_ts = millis_since_boot();
+  while (!exit_ && !updating_events_) {
+    ack_sm.update(100);
+    if (ack_sm.updated(ack)) {
+      const auto reply = ack_sm[ack];
+      const auto reply_frame_id = eventFrameId(reply);
+      if (reply.getLogMonoTime() >= published_ns && (!frame_id || !reply_frame_id || *frame_id == *reply_frame_id)) {
+        return true;
+      }
+      ++lockstep_mismatches_;
+    }
+
+    if (millis_since_boot() - start_ts > LOCKSTEP_TIMEOUT_MS) {
+      rError("no %s for %s at %.2f s within %d ms, %d unmatched acks so far",
+             ack, sockets_[e->which], currentSeconds(), LOCKSTEP_TIMEOUT_MS, lockstep_mismatches_);
+      return false;
+    }
+  }
+  return true;
+}
+
 void Replay::publishMessage(const Event *e) {
   if (event_filter && event_filter(e, filter_opaque)) return;
 
@@ -366,7 +451,8 @@ void Replay::publishMessage(const Event *e) {
       sockets_[e->which] = nullptr;
     }
   } else {
-    sm->update_msgs(nanos_since_boot(), {{sockets_[e->which], e->event}});
+    EventReader reader(*e);
+    sm->update_msgs(nanos_since_boot(), {{sockets_[e->which], reader.event}});
   }
 }
 
@@ -380,7 +466,8 @@ void Replay::publishFrame(const Event *e) {
       (e->which == cereal::Event::WIDE_ROAD_ENCODE_IDX && !hasFlag(REPLAY_FLAG_ECAM))) {
     return;
   }
-  auto eidx = capnp::AnyStruct::Reader(e->event).getPointerSection()[0].getAs<cereal::EncodeIndex>();
+  EventReader reader(*e);
+  auto eidx = capnp::AnyStruct::Reader(reader.event).getPointerSection()[0].getAs<cereal::EncodeIndex>();
   if (eidx.getType() == cereal::EncodeIndex::Type::FULL_H_E_V_C && isSegmentMerged(eidx.getSegmentNum())) {
     CameraType cam = cam_types.at(e->which);
     camera_server_->pushFrame(cam, segments_[eidx.getSegmentNum()]->frames[cam].get(), eidx);
@@ -392,14 +479,28 @@ void Replay::stream() {
   double prev_replay_speed = 1.0;
   std::unique_lock lk(stream_lock_);
 
+  std::unique_ptr<SubMaster> ack_sm;
+  if (!lockstep_acks_.empty()) {
+    std::vector<const char*> ack_services;
+    for (const char *ack : lockstep_acks_) {
+      // the names point into services[], so equal names are equal pointers
+      if (ack && std::find(ack_services.begin(), ack_services.end(), ack) == ack_services.end()) {
+        ack_services.push_back(ack);
+      }
+    }
+    if (!ack_services.empty()) {
+      ack_sm = std::make_unique<SubMaster>(ack_services);
+    }
+  }
+
   while (true) {
     stream_cv_.wait(lk, [=]() { return exit_ || (events_updated_ && !paused_); });
     events_updated_ = false;
     if (exit_) break;
 
     Event cur_event(cur_which, cur_mono_time_);
-    auto eit = std::upper_bound(events_->begin(), events_->end(), &cur_event, Event::lessThan());
-    if (eit == events_->end()) {
+    EventIterator eit(events_, &cur_event);
+    if (eit.end()) {
       rInfo("waiting for events...");
       continue;
     }
@@ -407,8 +508,8 @@ void Replay::stream() {
     uint64_t evt_start_ts = cur_mono_time_;
     uint64_t loop_start_ts = nanos_since_boot();
 
-    for (auto end = events_->end(); !updating_events_ && eit != end; ++eit) {
-      const Event *evt = (*eit);
+    while (!updating_events_ && !eit.end()) {
+      const Event *evt = eit.next();
       cur_which = evt->which;
       cur_mono_time_ = evt->mono_time;
       setCurrentSegment(toSeconds(cur_mono_time_) / 60);
@@ -434,10 +535,17 @@ void Replay::stream() {
           evt_start_ts = cur_mono_time_;
           loop_start_ts = nanos_since_boot();
           prev_replay_speed = speed_;
-        } else if (behind_ns > 0 && !hasFlag(REPLAY_FLAG_FULL_SPEED)) {
+        } else if (behind_ns > 0 && !hasFlag(REPLAY_FLAG_FULL_SPEED) && !ack_sm) {
           precise_nano_sleep(behind_ns);
         }
 
+        const bool lockstep_trigger = ack_sm && lockstep_acks_[cur_which];
+        if (lockstep_trigger) {
+          // drop the acks that are already queued, they can't be for this trigger
+          ack_sm->update(0);
+        }
+        const uint64_t published_ns = nanos_since_boot();
+
         if (!evt->frame) {
           publishMessage(evt);
         } else if (camera_server_) {
@@ -446,6 +554,13 @@ void Replay::stream() {
           }
           publishFrame(evt);
         }
+        // lockstep: advance once the consumer has handled this event. without a reply the run is
+        // no longer reproducible, so stop there. resuming continues after this event.
+        if (lockstep_trigger && !waitForAck(*ack_sm, evt, published_ns)) {
+          rWarning("lockstep: paused at %.2f s", currentSeconds());
+          paused_ = true;
+          break;
+        }
       }
     }
     // wait for frame to be sent before unlock.(frameReader may be deleted after unlock)
@@ -453,7 +568,7 @@ void Replay::stream() {
       camera_server_->waitForSent();
     }
 
-    if (eit == events_->end() && !hasFlag(REPLAY_FLAG_NO_LOOP)) {
+    if (eit.end() && !hasFlag(REPLAY_FLAG_NO_LOOP)) {
       int last_segment = segments_.rbegin()->first;
       if (current_segment_ >= last_segment && isSegmentMerged(last_segment)) {
         rInfo("reaches the end of route, restart from beginning");
@@ -462,3 +577,30 @@ void Replay::stream() {
     }
   }
 }
+
+// class EventIterator
+
+EventIterator::EventIterator(const SegmentEvents &events, const Event *from) {
+  for (const auto &[n, e] : events) {
+    auto first = e->cbegin();
+    // only publish initData of the first merged segment
+    if (n != events.begin()->first && first != e->cend() && first->which == cereal::Event::Which::INIT_DATA) {
+      ++first;
+    }
+    auto it = std::upper_bound(first, e->cend(), *from, Event::lessThan());
+    if (it != e->cend()) {
+      cursors_.push_back({it, e->cend()});
+    }
+  }
+}
+
+const Event *EventIterator::next() {
+  auto c = std::min_element(cursors_.begin(), cursors_.end(), [](const auto &l, const auto &r) {
+    return Event::lessThan()(*l.first, *r.first);
+  });
+  const Event *e = &(*c->first);
+  if (++c->first == c->second) {
+    cursors_.erase(c);
+  }
+  return e;
+}
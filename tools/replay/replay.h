@@ -11,6 +11,8 @@ const QString DEMO_ROUTE = "4cf7a6ad03080c90|2021-09-29--13-46-36";
 
 // one segment uses about 100M of memory
 constexpr int MIN_SEGMENTS_CACHE = 5;
+// max number of segments downloaded and decoded at the same time
+constexpr int DEFAULT_MAX_LOADING_SEGMENTS = 3;
 
 enum REPLAY_FLAGS {
   REPLAY_FLAG_NONE = 0x0000,
@@ -23,8 +25,15 @@ enum REPLAY_FLAGS {
   REPLAY_FLAG_FULL_SPEED = 0x0200,
   REPLAY_FLAG_NO_VIPC = 0x0400,
   REPLAY_FLAG_ALL_SERVICES = 0x0800,
+  REPLAY_FLAG_PREFETCH_FRAMES = 0x1000,
+  REPLAY_FLAG_PIN_DECODERS = 0x2000,
 };
 
+// frames decoded ahead with REPLAY_FLAG_PREFETCH_FRAMES
+constexpr int PREFETCH_FRAMES = 4;
+// how long lockstep replay waits for a consumer before it pauses
+constexpr int LOCKSTEP_TIMEOUT_MS = 10000;
+
 enum class FindFlag {
   nextEngagement,
   nextDisEngagement,
@@ -36,6 +45,20 @@ enum class FindFlag {
 
 enum class TimelineType { None, Engaged, AlertInfo, AlertWarning, AlertCritical, UserFlag };
 typedef bool (*replayEventFilter)(const Event *, void *);
+// sorted events of every merged segment, keyed by segment number
+typedef std::map<int, const std::vector<Event> *> SegmentEvents;
+
+// iterates the events of the merged segments in time order, starting after `from`.
+// segments overlap only at the boundaries, so this is a cheap k-way merge over the segments.
+class EventIterator {
+public:
+  EventIterator(const SegmentEvents &events, const Event *from);
+  inline bool end() const { return cursors_.empty(); }
+  const Event *next();
+
+private:
+  std::vector<std::pair<std::vector<Event>::const_iterator, std::vector<Event>::const_iterator>> cursors_;
+};
 
 class Replay : public QObject {
   Q_OBJECT
@@ -60,6 +83,15 @@ public:
   }
   inline int segmentCacheLimit() const { return segment_cache_limit; }
   inline void setSegmentCacheLimit(int n) { segment_cache_limit = std::max(MIN_SEGMENTS_CACHE, n); }
+  inline int maxLoadingSegments() const { return max_loading_segments; }
+  inline void setMaxLoadingSegments(int n) { max_loading_segments = std::max(1, n); }
+  // threads of each camera's CPU decoder, 0 splits the cores evenly between the replayed cameras
+  inline void setDecodeThreads(int n) { decode_threads = std::max(0, n); }
+  int decodeThreadsPerCamera() const;
+  inline float decodeFps(CameraType type) const { return camera_server_ ? camera_server_->decodeFps(type) : 0; }
+  // lockstep replay: after publishing a trigger service, wait until its consumer publishes the ack service,
+  // e.g. {"roadEncodeIdx", "modelV2"}. the ack services must not be published by replay. call before start().
+  bool setLockstep(const std::vector<std::pair<std::string, std::string>> &triggers);
   inline bool hasFlag(REPLAY_FLAGS flag) const { return flags_ & flag; }
   inline void addFlag(REPLAY_FLAGS flag) { flags_ |= flag; }
   inline void removeFlag(REPLAY_FLAGS flag) { flags_ &= ~flag; }
@@ -71,7 +103,7 @@ public:
   inline int totalSeconds() const { return (!segments_.empty()) ? (segments_.rbegin()->first + 1) * 60 : 0; }
   inline void setSpeed(float speed) { speed_ = speed; }
   inline float getSpeed() const { return speed_; }
-  inline const std::vector<Event *> *events() const { return events_.get(); }
+  inline const SegmentEvents &events() const { return events_; }
   inline const std::map<int, std::unique_ptr<Segment>> &segments() const { return segments_; };
   inline const std::string &carFingerprint() const { return car_fingerprint_; }
   inline const std::vector<std::tuple<int, int, TimelineType>> getTimeline() {
@@ -98,6 +130,8 @@ protected:
   void updateEvents(const std::function<bool()>& lambda);
   void publishMessage(const Event *e);
   void publishFrame(const Event *e);
+  // false if no matching ack arrived within LOCKSTEP_TIMEOUT_MS
+  bool waitForAck(SubMaster &ack_sm, const Event *e, uint64_t published_ns);
   void buildTimeline();
   inline bool isSegmentMerged(int n) {
     return std::find(segments_merged_.begin(), segments_merged_.end(), n) != segments_merged_.end();
@@ -117,14 +151,17 @@ protected:
   bool events_updated_ = false;
   uint64_t route_start_ts_ = 0;
   std::atomic<uint64_t> cur_mono_time_ = 0;
-  std::unique_ptr<std::vector<Event *>> events_;
-  std::unique_ptr<std::vector<Event *>> new_events_;
+  SegmentEvents events_;
   std::vector<int> segments_merged_;
 
   // messaging
   SubMaster *sm = nullptr;
   std::unique_ptr<PubMaster> pm;
   std::vector<const char*> sockets_;
+  // ack service of each lockstep trigger, indexed like sockets_
+  std::vector<const char*> lockstep_acks_;
+  // acks that arrived while waiting but didn't match their trigger
+  int lockstep_mismatches_ = 0;
   std::unique_ptr<Route> route_;
   std::unique_ptr<CameraServer> camera_server_;
   std::atomic<uint32_t> flags_ = REPLAY_FLAG_NONE;
@@ -138,4 +175,6 @@ protected:
   replayEventFilter event_filter = nullptr;
   void *filter_opaque = nullptr;
   int segment_cache_limit = MIN_SEGMENTS_CACHE;
+  int max_loading_segments = DEFAULT_MAX_LOADING_SEGMENTS;
+  int decode_threads = 0;
 };
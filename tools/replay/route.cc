@@ -7,7 +7,9 @@
 #include <QRegExp>
 #include <QtConcurrent>
 
+#include <algorithm>
 #include <array>
+#include <thread>
 
 #include "system/hardware/hw.h"
 #include "selfdrive/ui/qt/api.h"
@@ -101,8 +103,8 @@ void Route::addFileToSegment(int n, const QString &file) {
 // class Segment
 
 Segment::Segment(int n, const SegmentFile &files, uint32_t flags,
-                 const std::set<cereal::Event::Which> &allow)
-    : seg_num(n), flags(flags), allow(allow) {
+                 const std::set<cereal::Event::Which> &allow, int decode_threads)
+    : seg_num(n), flags(flags), allow(allow), decode_threads(decode_threads) {
   // [RoadCam, DriverCam, WideRoadCam, log]. fallback to qcamera/qlog
   const std::array file_list = {
       (flags & REPLAY_FLAG_QCAMERA) || files.road_cam.isEmpty() ? files.qcamera : files.road_cam,
@@ -130,7 +132,20 @@ void Segment::loadFile(int id, const std::string file) {
   bool success = false;
   if (id < MAX_CAMERAS) {
     frames[id] = std::make_unique<FrameReader>();
+    std::vector<int> cpus;
+    if (flags & REPLAY_FLAG_PIN_DECODERS) {
+      // a camera gets the same cores in every segment, one segment of a camera decodes at a time
+      const int cpu_count = std::max(1u, std::thread::hardware_concurrency());
+      const int slot = (id > RoadCam && (flags & REPLAY_FLAG_DCAM)) + (id > DriverCam && (flags & REPLAY_FLAG_ECAM));
+      for (int i = 0; i < decode_threads; ++i) {
+        cpus.push_back((slot * decode_threads + i) % cpu_count);
+      }
+    }
+    frames[id]->setCpuDecoding(decode_threads, cpus);
     success = frames[id]->load(file, flags & REPLAY_FLAG_NO_HW_DECODER, &abort_, local_cache, 20 * 1024 * 1024, 3);
+    if (success && (flags & REPLAY_FLAG_PREFETCH_FRAMES)) {
+      frames[id]->startPrefetch(PREFETCH_FRAMES);
+    }
   } else {
     log = std::make_unique<LogReader>();
     success = log->load(file, &abort_, allow, local_cache, 0, 3);
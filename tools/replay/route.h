@@ -50,7 +50,8 @@ class Segment : public QObject {
   Q_OBJECT
 
 public:
-  Segment(int n, const SegmentFile &files, uint32_t flags, const std::set<cereal::Event::Which> &allow = {});
+  Segment(int n, const SegmentFile &files, uint32_t flags, const std::set<cereal::Event::Which> &allow = {},
+          int decode_threads = 0);
   ~Segment();
   inline bool isLoaded() const { return !loading_ && !abort_; }
 
@@ -69,4 +70,5 @@ protected:
   QFutureSynchronizer<void> synchronizer_;
   uint32_t flags;
   std::set<cereal::Event::Which> allow;
+  int decode_threads;
 };
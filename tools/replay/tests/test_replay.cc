@@ -6,6 +6,8 @@
 
 #include "catch2/catch.hpp"
 #include "common/util.h"
+#include "system/loggerd/logger.h"
+#include "tools/replay/logindex.h"
 #include "tools/replay/replay.h"
 #include "tools/replay/util.h"
 
@@ -75,6 +77,131 @@ TEST_CASE("LogReader") {
     REQUIRE(log.load((std::byte *)corrupt_content.data(), corrupt_content.size()));
     REQUIRE(log.events.size() > 0);
   }
+  SECTION("mapped local log") {
+    std::string content = decompressBZ2(FileReader(true).read(TEST_RLOG_URL));
+    char filename[] = "/tmp/rlog_XXXXXX";
+    close(mkstemp(filename));
+    REQUIRE(util::write_file(filename, content.data(), content.size(), O_WRONLY | O_TRUNC) == 0);
+
+    LogReader mapped_log, log;
+    REQUIRE(mapped_log.load(filename));
+    REQUIRE(log.load((std::byte *)content.data(), content.size()));
+    REQUIRE(mapped_log.events.size() == log.events.size());
+    for (size_t i = 0; i < log.events.size(); ++i) {
+      REQUIRE(mapped_log.events[i].mono_time == log.events[i].mono_time);
+      REQUIRE(mapped_log.events[i].bytes() == log.events[i].bytes());
+    }
+    unlink(filename);
+  }
+  SECTION("streamed remote log") {
+    std::string content = decompressBZ2(FileReader(true).read(TEST_RLOG_URL));
+    LogReader streamed_log, log;
+    REQUIRE(streamed_log.load(TEST_RLOG_URL, nullptr, {}, false, 0, 3));
+    REQUIRE(log.load((std::byte *)content.data(), content.size()));
+    REQUIRE(streamed_log.events.size() == log.events.size());
+    for (size_t i = 0; i < log.events.size(); ++i) {
+      REQUIRE(streamed_log.events[i].bytes() == log.events[i].bytes());
+    }
+  }
+  SECTION("log index") {
+    std::remove(logIndexFilePath(TEST_RLOG_URL).c_str());
+    LogReader log, indexed_log;
+    REQUIRE(log.load(TEST_RLOG_URL, nullptr, {}, true, 0, 3));
+    LogIndex index;
+    REQUIRE(index.load(TEST_RLOG_URL));
+    REQUIRE(index.entries.size() == log.events.size());
+    REQUIRE(index.begin_mono_time == log.events.front().mono_time);
+    REQUIRE(index.end_mono_time == log.events.back().mono_time);
+
+    REQUIRE(indexed_log.load(TEST_RLOG_URL, nullptr, {}, true, 0, 3));
+    REQUIRE(indexed_log.events.size() == log.events.size());
+    for (size_t i = 0; i < log.events.size(); ++i) {
+      REQUIRE(indexed_log.events[i].frame == log.events[i].frame);
+      REQUIRE(indexed_log.events[i].bytes() == log.events[i].bytes());
+    }
+
+    // a corrupt or truncated index is stale, not a huge allocation
+    std::string index_file = logIndexFilePath(TEST_RLOG_URL);
+    std::string index_content = util::read_file(index_file);
+    const uint64_t huge_count = UINT64_MAX / 2;
+    std::string corrupt = index_content;
+    memcpy(corrupt.data() + 52, &huge_count, sizeof(huge_count));  // the entry count, after the header
+    REQUIRE(util::write_file(index_file.c_str(), corrupt.data(), corrupt.size(), O_WRONLY | O_TRUNC) == 0);
+    REQUIRE_FALSE(LogIndex().load(TEST_RLOG_URL));
+    REQUIRE(util::write_file(index_file.c_str(), index_content.data(), index_content.size() / 2, O_WRONLY | O_TRUNC) == 0);
+    REQUIRE_FALSE(LogIndex().load(TEST_RLOG_URL));
+    std::remove(index_file.c_str());
+  }
+}
+
+TEST_CASE("LogReader time range") {
+  std::string content = decompressBZ2(FileReader(true).read(TEST_RLOG_URL));
+  char filename[] = "/tmp/rlog_XXXXXX";
+  close(mkstemp(filename));
+  REQUIRE(util::write_file(filename, content.data(), content.size(), O_WRONLY | O_TRUNC) == 0);
+
+  LogReader log;
+  REQUIRE(log.load((std::byte *)content.data(), content.size()));
+  const uint64_t begin = log.events.front().mono_time, end = log.events.back().mono_time;
+  const std::pair<uint64_t, uint64_t> range = {begin + (end - begin) / 3, begin + (end - begin) * 2 / 3};
+  const std::set<cereal::Event::Which> allow = {cereal::Event::CAR_STATE, cereal::Event::ROAD_ENCODE_IDX};
+  auto in_range = [&](const Event &e) {
+    return e.mono_time >= range.first && e.mono_time <= range.second && allow.count(e.which);
+  };
+  std::vector<Event> expected_events;
+  std::copy_if(log.events.begin(), log.events.end(), std::back_inserter(expected_events), in_range);
+  const size_t expected = expected_events.size();
+  REQUIRE(expected > 0);
+
+  auto verify = [&]() {
+    LogReader ranged_log;
+    REQUIRE(ranged_log.load(filename, range, allow));
+    REQUIRE(ranged_log.events.size() == expected);
+    for (size_t i = 0; i < expected; ++i) {
+      const Event &e = ranged_log.events[i], &expected_e = expected_events[i];
+      REQUIRE((e.mono_time == expected_e.mono_time && e.which == expected_e.which));
+      REQUIRE(std::equal(e.bytes().begin(), e.bytes().end(), expected_e.bytes().begin(), expected_e.bytes().end()));
+    }
+  };
+
+  SECTION("without segment index") {
+    verify();
+  }
+  SECTION("with segment index") {
+    // write the log and its index the way loggerd does, one message at a time
+    const std::string index_file = std::string(filename) + ".idx";
+    std::vector<std::pair<uint64_t, size_t>> offsets;  // mono_time and offset of every message
+    {
+      RawFile raw(filename, false, index_file.c_str());
+      kj::ArrayPtr<const capnp::word> words((const capnp::word *)content.data(), content.size() / sizeof(capnp::word));
+      while (words.size() > 0) {
+        capnp::FlatArrayMessageReader reader(words);
+        offsets.emplace_back(reader.getRoot<cereal::Event>().getLogMonoTime(), (words.begin() - (const capnp::word *)content.data()) * sizeof(capnp::word));
+        auto bytes = kj::arrayPtr(words.begin(), reader.getEnd()).asBytes();
+        raw.write((void *)bytes.begin(), bytes.size());
+        words = kj::arrayPtr(reader.getEnd(), words.end());
+      }
+    }
+    REQUIRE(util::file_exists(index_file));
+
+    // garble the first and the last sixth of the log. they are well outside the part the index maps the range to,
+    // so the events only come out right if the reader skipped them.
+    const uint64_t head_end = begin + (end - begin) / 6, tail_begin = begin + (end - begin) * 5 / 6;
+    auto head = std::find_if(offsets.begin(), offsets.end(), [&](auto &o) { return o.first >= head_end; });
+    auto tail = std::find_if(offsets.begin(), offsets.end(), [&](auto &o) { return o.first > tail_begin; });
+    REQUIRE((head != offsets.end() && tail != offsets.end()));
+    std::string garbled = content;
+    std::fill(garbled.begin(), garbled.begin() + head->second, '\xff');
+    std::fill(garbled.begin() + tail->second, garbled.end(), '\xff');
+    REQUIRE(util::write_file(filename, garbled.data(), garbled.size(), O_WRONLY | O_TRUNC) == 0);
+
+    verify();
+    // without the index, the garbled log is unreadable
+    unlink(index_file.c_str());
+    LogReader unindexed_log;
+    REQUIRE_FALSE((unindexed_log.load(filename, range, allow) && unindexed_log.events.size() == expected));
+  }
+  unlink(filename);
 }
 
 void read_segment(int n, const SegmentFile &segment_file, uint32_t flags) {
@@ -104,8 +231,18 @@ void read_segment(int n, const SegmentFile &segment_file, uint32_t flags) {
       }
       std::unique_ptr<uint8_t[]> yuv_buf = std::make_unique<uint8_t[]>(fr->getYUVSize());
       // sequence get 100 frames
+      std::vector<std::string> frame_hashes;
       for (int i = 0; i < 100; ++i) {
         REQUIRE(fr->get(i, yuv_buf.get()));
+        frame_hashes.push_back(sha256(std::string((char *)yuv_buf.get(), fr->getYUVSize())));
+      }
+      // stepping back returns the cached frames
+      for (int idx : {98, 99}) {
+        REQUIRE(fr->get(idx, yuv_buf.get()));
+        REQUIRE(sha256(std::string((char *)yuv_buf.get(), fr->getYUVSize())) == frame_hashes[idx]);
+      }
+      for (int i = 0; i < 10; ++i) {
+        REQUIRE(fr->get(random_int(0, 99), yuv_buf.get()));
       }
     }
 
@@ -151,6 +288,27 @@ TEST_CASE("Route") {
   };
 }
 
+TEST_CASE("FrameReader bytes copied", "[!benchmark]") {
+  Route route(DEMO_ROUTE);
+  REQUIRE(route.load());
+  const std::string url = route.at(0).road_cam.toStdString();
+
+  // the decoded frames should be written once, into the caller's buffer, on either decoder
+  auto no_hw_decoder = GENERATE(false, true);
+  FrameReader fr;
+  REQUIRE(fr.load(url, no_hw_decoder, nullptr, true));
+  std::unique_ptr<uint8_t[]> yuv_buf = std::make_unique<uint8_t[]>(fr.getYUVSize());
+  const int frames = 200;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < frames; ++i) {
+    REQUIRE(fr.get(i, yuv_buf.get()));
+  }
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("%s decoder: %.2f ms/frame, %zu bytes copied/frame, frame size %d\n", no_hw_decoder ? "cpu" : "default",
+         secs / frames * 1e3, fr.bytesCopied() / frames, fr.getYUVSize());
+  REQUIRE(fr.bytesCopied() == (size_t)frames * fr.getYUVSize());
+}
+
 // helper class for unit tests
 class TestReplay : public Replay {
  public:
@@ -172,15 +330,25 @@ void TestReplay::testSeekTo(int seek_to) {
     }
 
     Event cur_event(cereal::Event::Which::INIT_DATA, cur_mono_time_);
-    auto eit = std::upper_bound(events_->begin(), events_->end(), &cur_event, Event::lessThan());
-    if (eit == events_->end()) {
+    EventIterator eit(events_, &cur_event);
+    if (eit.end()) {
       qDebug() << "waiting for events...";
       continue;
     }
 
-    REQUIRE(std::is_sorted(events_->begin(), events_->end(), Event::lessThan()));
+    for (const auto &[n, e] : events_) {
+      REQUIRE(std::is_sorted(e->begin(), e->end(), Event::lessThan()));
+    }
+    const Event *first = eit.next();
+    uint64_t prev_mono_time = first->mono_time;
+    while (!eit.end()) {
+      const Event *e = eit.next();
+      REQUIRE(e->mono_time >= prev_mono_time);
+      prev_mono_time = e->mono_time;
+    }
+
     const int seek_to_segment = seek_to / 60;
-    const int event_seconds = ((*eit)->mono_time - route_start_ts_) / 1e9;
+    const int event_seconds = (first->mono_time - route_start_ts_) / 1e9;
     current_segment_ = event_seconds / 60;
     INFO("seek to [" << seek_to << "s segment " << seek_to_segment << "], events [" << event_seconds << "s segment" << current_segment_ << "]");
     REQUIRE(event_seconds >= seek_to);
@@ -120,6 +120,22 @@ struct DownloadStats {
   double prev_tm = 0;
 };
 
+static DownloadStats download_stats;
+
+struct StreamWriter {
+  const DownloadDataHandler *handler;
+  size_t written;
+};
+
+size_t stream_write_cb(char *data, size_t size, size_t count, void *userp) {
+  auto w = (StreamWriter *)userp;
+  size_t bytes = size * count;
+  if (!(*w->handler)(data, bytes)) return 0;
+
+  w->written += bytes;
+  return bytes;
+}
+
 } // namespace
 
 std::string formattedDataSize(size_t size) {
@@ -164,7 +180,6 @@ std::string getUrlWithoutQuery(const std::string &url) {
 
 template <class T>
 bool httpDownload(const std::string &url, T &buf, size_t chunk_size, size_t content_length, std::atomic<bool> *abort) {
-  static DownloadStats download_stats;
   download_stats.add(url, content_length);
 
   int parts = 1;
@@ -243,6 +258,54 @@ std::string httpGet(const std::string &url, size_t chunk_size, std::atomic<bool>
   return httpDownload(url, result, chunk_size, size, abort) ? result : "";
 }
 
+bool httpGetStream(const std::string &url, const DownloadDataHandler &handler, std::atomic<bool> *abort) {
+  size_t size = getRemoteFileSize(url, abort);
+  if (size == 0) return false;
+
+  CURL *curl = curl_easy_init();
+  if (!curl) return false;
+
+  download_stats.add(url, size);
+  StreamWriter writer = {.handler = &handler, .written = 0};
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, stream_write_cb);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&writer);
+  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(curl, CURLOPT_HTTPGET, 1);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
+
+  CURLM *cm = curl_multi_init();
+  curl_multi_add_handle(cm, curl);
+  int still_running = 1;
+  while (still_running > 0 && !(abort && *abort)) {
+    curl_multi_wait(cm, nullptr, 0, 1000, nullptr);
+    curl_multi_perform(cm, &still_running);
+    download_stats.update(url, writer.written);
+  }
+
+  bool success = false;
+  CURLMsg *msg;
+  int msgs_left = -1;
+  while ((msg = curl_multi_info_read(cm, &msgs_left)) && !(abort && *abort)) {
+    if (msg->msg == CURLMSG_DONE) {
+      long res_status = 0;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &res_status);
+      if (msg->data.result == CURLE_OK && res_status == 200) {
+        success = writer.written == size;
+      } else {
+        rWarning("Download failed: result %d, http code: %d", msg->data.result, res_status);
+      }
+    }
+  }
+
+  download_stats.update(url, writer.written, success);
+  download_stats.remove(url);
+  curl_multi_remove_handle(cm, curl);
+  curl_easy_cleanup(curl);
+  curl_multi_cleanup(cm);
+  return success;
+}
+
 bool httpDownload(const std::string &url, const std::string &file, size_t chunk_size, std::atomic<bool> *abort) {
   size_t size = getRemoteFileSize(url, abort);
   if (size == 0) return false;
@@ -273,9 +336,9 @@ std::string decompressBZ2(const std::byte *in, size_t in_size, std::atomic<bool>
     const char *prev_write_pos = strm.next_out;
     bzerror = BZ2_bzDecompress(&strm);
     if (bzerror == BZ_OK && prev_write_pos == strm.next_out) {
-      // content is corrupt
+      // content is corrupt, or truncated at a flush point while loggerd is still writing it
       bzerror = BZ_STREAM_END;
-      rWarning("decompressBZ2 error : content is corrupt");
+      rWarning(strm.avail_in == 0 ? "decompressBZ2: stream is not finished" : "decompressBZ2 error : content is corrupt");
       break;
     }
 
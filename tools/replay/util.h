@@ -27,6 +27,9 @@ std::string decompressBZ2(const std::byte *in, size_t in_size, std::atomic<bool>
 std::string getUrlWithoutQuery(const std::string &url);
 size_t getRemoteFileSize(const std::string &url, std::atomic<bool> *abort = nullptr);
 std::string httpGet(const std::string &url, size_t chunk_size = 0, std::atomic<bool> *abort = nullptr);
+// download sequentially, handing each received chunk to the callback. return false from the callback to stop.
+typedef std::function<bool(const char *data, size_t size)> DownloadDataHandler;
+bool httpGetStream(const std::string &url, const DownloadDataHandler &handler, std::atomic<bool> *abort = nullptr);
 
 typedef std::function<void(uint64_t cur, uint64_t total, bool success)> DownloadProgressHandler;
 void installDownloadProgressHandler(DownloadProgressHandler);